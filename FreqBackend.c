@@ -0,0 +1,490 @@
+/*
+ * FreqBackend.c
+ *
+ * The regex matchers that freq_scan() can use. Each one is a RegexBackend: a
+ * way to compile a pattern, find its leftmost match in a string, and free it.
+ * Every backend compiles the pattern the way regcomp() does with REG_EXTENDED
+ * and REG_ICASE, and reports the match and the first subexpression the way
+ * regexec() does.
+ *
+ * - posix: glibc's regcomp() and regexec().
+ * - pike: a Pike VM, which simulates the pattern's NFA one byte at a time with
+ *   one thread per state, so it never backtracks. It only handles the patterns
+ *   that regex_parse() accepts. Ties between matches of the same length go to
+ *   the greedier path, which agrees with POSIX for all of the FREQ_* patterns.
+ * - generated: the scanners that FreqGen writes into FreqScanners.c, if
+ *   FREQ_HAVE_SCANNERS is defined at build time (make does this). It only
+ *   compiles the FREQ_* patterns that FreqGen could turn into a DFA.
+ * - pcre2: PCRE2 with its JIT, if FREQ_HAVE_PCRE2 is defined at build time.
+ *   PCRE2 takes the first alternative that matches rather than the longest
+ *   match, so it only agrees with the others on patterns where those are the
+ *   same.
+ *
+ * In order to use this file you must include regex.h and FreqRegex.c, and
+ * FreqPatterns.h if FREQ_HAVE_SCANNERS is defined.
+ */
+
+#ifdef FREQ_HAVE_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#endif
+
+typedef struct {
+	const char *name;
+
+	/* Compiles (regex) into (*state). Returns 0 on success or -2 if the
+	 * backend cannot compile the pattern.
+	 */
+	int (*compile)(void **state, const char *regex);
+
+	/* Finds the leftmost match in the NUL-terminated (string). Fills in
+	 * match[0] and match[1] and returns 0, or returns REG_NOMATCH or REG_ESPACE.
+	 */
+	int (*exec)(void *state, const char *string, regmatch_t match[2]);
+
+	void (*free)(void *state);
+} RegexBackend;
+
+int posix_compile(void **state, const char *regex);
+int posix_exec(void *state, const char *string, regmatch_t match[2]);
+void posix_free(void *state);
+
+int pike_compile(void **state, const char *regex);
+int pike_exec(void *state, const char *string, regmatch_t match[2]);
+void pike_free(void *state);
+
+static const RegexBackend posix_backend = {
+	"posix", posix_compile, posix_exec, posix_free
+};
+
+static const RegexBackend pike_backend = {
+	"pike", pike_compile, pike_exec, pike_free
+};
+
+#ifdef FREQ_HAVE_SCANNERS
+typedef struct {
+	const char *regex;
+	int (*exec)(const char *string, regmatch_t match[2]);
+} GenScanner;
+
+#include "FreqScanners.c"
+
+int generated_compile(void **state, const char *regex);
+int generated_exec(void *state, const char *string, regmatch_t match[2]);
+void generated_free(void *state);
+
+static const RegexBackend generated_backend = {
+	"generated", generated_compile, generated_exec, generated_free
+};
+#endif
+
+#ifdef FREQ_HAVE_PCRE2
+int pcre2_backend_compile(void **state, const char *regex);
+int pcre2_backend_exec(void *state, const char *string, regmatch_t match[2]);
+void pcre2_backend_free(void *state);
+
+static const RegexBackend pcre2_backend = {
+	"pcre2", pcre2_backend_compile, pcre2_backend_exec, pcre2_backend_free
+};
+#endif
+
+/* 
+ * Every backend in this build, for the benchmark. It is not static, since only
+ * frequency.c runs the benchmark and FreqGen and libfrequency.a would warn.
+ */
+const RegexBackend *regex_backends[] = {
+	&posix_backend,
+	&pike_backend,
+#ifdef FREQ_HAVE_SCANNERS
+	&generated_backend,
+#endif
+#ifdef FREQ_HAVE_PCRE2
+	&pcre2_backend,
+#endif
+};
+
+
+int posix_compile(void **state, const char *regex)
+{
+	regex_t *compiled = malloc(sizeof(regex_t));
+	if (compiled == NULL) return -2;
+
+	if (regcomp(compiled, regex, REG_EXTENDED | REG_ICASE)) {
+		free(compiled);
+		return -2;
+	}
+
+	*state = compiled;
+	return 0;
+}
+
+int posix_exec(void *state, const char *string, regmatch_t match[2])
+{
+	return regexec((regex_t *) state, string, 2, match, 0);
+}
+
+void posix_free(void *state)
+{
+	regfree((regex_t *) state);
+	free(state);
+}
+
+
+/*
+ * The Pike VM. A program is a list of instructions:
+ *
+ * PIKE_SET: consume one byte from sets[x], then go on to the next instruction.
+ * PIKE_SPLIT: continue at both x and y, preferring x.
+ * PIKE_JMP: continue at x.
+ * PIKE_SAVE: record the current position in capture slot x.
+ * PIKE_MATCH: the pattern has matched.
+ *
+ * Slots 0 and 1 hold the start and end of the match, and slots 2 and 3 hold the
+ * first subexpression. Other subexpressions are not recorded.
+ */
+
+#define PIKE_MAX_PROGRAM 4096
+
+enum { PIKE_SET, PIKE_SPLIT, PIKE_JMP, PIKE_SAVE, PIKE_MATCH };
+
+typedef struct {
+	int op;
+	int x, y;
+} PikeInst;
+
+typedef struct {
+	int pc;
+	int caps[4];
+} PikeThread;
+
+typedef struct {
+	PikeThread *threads;
+	int length;
+} PikeList;
+
+typedef struct {
+	PikeInst *prog;
+	int length;
+	ByteSet *sets;
+	int nsets;
+
+	/* Scratch space for pike_exec(), sized for the program. */
+	PikeList lists[2];
+	unsigned *seen; /* seen[pc] == generation iff pc is already in the list being built */
+	unsigned generation;
+
+	/* The best match so far. */
+	bool found;
+	int best[4];
+} PikeVM;
+
+int pike_emit(PikeVM *vm, int op, int x, int y);
+int pike_emit_node(PikeVM *vm, const Regex *re, int node);
+void pike_add(PikeVM *vm, PikeList *list, int pc, int caps[4], int pos);
+
+int pike_emit(PikeVM *vm, int op, int x, int y)
+{
+	if (vm->length == PIKE_MAX_PROGRAM)
+		return -1;
+
+	vm->prog[vm->length].op = op;
+	vm->prog[vm->length].x = x;
+	vm->prog[vm->length].y = y;
+	return vm->length++;
+}
+
+/*
+ * Appends the code for (node) to the program. Returns 0, or -1 if the program
+ * is too long.
+ */
+int pike_emit_node(PikeVM *vm, const Regex *re, int node)
+{
+	const RegexNode *x = &re->nodes[node];
+	int split, jmp, k, loop;
+	int ends[PIKE_MAX_PROGRAM];
+
+	switch (x->type) {
+	case REGEX_EMPTY:
+		return 0;
+
+	case REGEX_SET:
+		vm->sets[vm->nsets] = x->set;
+		return pike_emit(vm, PIKE_SET, vm->nsets++, 0) < 0 ? -1 : 0;
+
+	case REGEX_CAT:
+		if (pike_emit_node(vm, re, x->left)) return -1;
+		return pike_emit_node(vm, re, x->right);
+
+	case REGEX_ALT:
+		if ((split = pike_emit(vm, PIKE_SPLIT, 0, 0)) < 0) return -1;
+		vm->prog[split].x = vm->length;
+		if (pike_emit_node(vm, re, x->left)) return -1;
+		if ((jmp = pike_emit(vm, PIKE_JMP, 0, 0)) < 0) return -1;
+		vm->prog[split].y = vm->length;
+		if (pike_emit_node(vm, re, x->right)) return -1;
+		vm->prog[jmp].x = vm->length;
+		return 0;
+
+	case REGEX_GROUP:
+		if (x->group == 1 && pike_emit(vm, PIKE_SAVE, 2, 0) < 0) return -1;
+		if (pike_emit_node(vm, re, x->left)) return -1;
+		if (x->group == 1 && pike_emit(vm, PIKE_SAVE, 3, 0) < 0) return -1;
+		return 0;
+
+	case REGEX_REPEAT:
+		for (k = 0; k < x->min; ++k)
+			if (pike_emit_node(vm, re, x->left)) return -1;
+
+		if (x->max == REGEX_UNBOUNDED) {
+			if ((loop = pike_emit(vm, PIKE_SPLIT, 0, 0)) < 0) return -1;
+			vm->prog[loop].x = vm->length;
+			if (pike_emit_node(vm, re, x->left)) return -1;
+			if (pike_emit(vm, PIKE_JMP, loop, 0) < 0) return -1;
+			vm->prog[loop].y = vm->length;
+			return 0;
+		}
+
+		/* Each optional copy may be skipped, which skips the rest as well. */
+		for (k = x->min; k < x->max; ++k) {
+			if ((ends[k - x->min] = pike_emit(vm, PIKE_SPLIT, 0, 0)) < 0) return -1;
+			vm->prog[ends[k - x->min]].x = vm->length;
+			if (pike_emit_node(vm, re, x->left)) return -1;
+		}
+		for (k = x->min; k < x->max; ++k)
+			vm->prog[ends[k - x->min]].y = vm->length;
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+int pike_compile(void **state, const char *regex)
+{
+	Regex *re = malloc(sizeof(Regex));
+	PikeVM *vm = calloc(1, sizeof(PikeVM));
+	if (re == NULL || vm == NULL || regex_parse(re, regex, true)) {
+		free(re);
+		free(vm);
+		return -2;
+	}
+
+	vm->prog = malloc(sizeof(PikeInst) * PIKE_MAX_PROGRAM);
+	vm->sets = malloc(sizeof(ByteSet) * PIKE_MAX_PROGRAM);
+	int ret = vm->prog && vm->sets ? pike_emit_node(vm, re, re->root) : -1;
+	if (ret == 0 && pike_emit(vm, PIKE_MATCH, 0, 0) < 0)
+		ret = -1;
+	free(re);
+
+	if (ret == 0) {
+		vm->lists[0].threads = malloc(sizeof(PikeThread) * vm->length);
+		vm->lists[1].threads = malloc(sizeof(PikeThread) * vm->length);
+		vm->seen = calloc(vm->length, sizeof(unsigned));
+		if (!vm->lists[0].threads || !vm->lists[1].threads || !vm->seen)
+			ret = -1;
+	}
+
+	if (ret) {
+		pike_free(vm);
+		return -2;
+	}
+
+	*state = vm;
+	return 0;
+}
+
+/*
+ * Adds a thread at (pc) to (list), following jumps, splits and saves until it
+ * reaches an instruction that consumes a byte. A thread that reaches PIKE_MATCH
+ * is a match ending at (pos); it replaces the best match if it starts earlier,
+ * or at the same place and ends later.
+ */
+void pike_add(PikeVM *vm, PikeList *list, int pc, int caps[4], int pos)
+{
+	if (vm->seen[pc] == vm->generation)
+		return;
+	vm->seen[pc] = vm->generation;
+
+	const PikeInst *inst = &vm->prog[pc];
+	int saved;
+
+	switch (inst->op) {
+	case PIKE_SET:
+		list->threads[list->length].pc = pc;
+		memcpy(list->threads[list->length].caps, caps, sizeof(int) * 4);
+		++list->length;
+		break;
+
+	case PIKE_SPLIT:
+		pike_add(vm, list, inst->x, caps, pos);
+		pike_add(vm, list, inst->y, caps, pos);
+		break;
+
+	case PIKE_JMP:
+		pike_add(vm, list, inst->x, caps, pos);
+		break;
+
+	case PIKE_SAVE:
+		saved = caps[inst->x];
+		caps[inst->x] = pos;
+		pike_add(vm, list, pc + 1, caps, pos);
+		caps[inst->x] = saved;
+		break;
+
+	case PIKE_MATCH:
+		if (!vm->found || caps[0] < vm->best[0] ||
+				(caps[0] == vm->best[0] && pos > vm->best[1])) {
+			vm->found = true;
+			memcpy(vm->best, caps, sizeof(int) * 4);
+			vm->best[1] = pos;
+		}
+		break;
+	}
+}
+
+int pike_exec(void *state, const char *string, regmatch_t match[2])
+{
+	PikeVM *vm = state;
+	PikeList *cur = &vm->lists[0], *next = &vm->lists[1], *tmp;
+	int caps[4];
+	int pos, i;
+
+	vm->found = false;
+	cur->length = 0;
+
+	/* Threads are kept in order of where they started, so that when two reach
+	 * the same instruction, the one that started earlier wins.
+	 */
+	for (pos = 0; ; ++pos) {
+		if (!vm->found) {
+			++vm->generation;
+			/* Mark the instructions that are already in the list. */
+			for (i = 0; i < cur->length; ++i)
+				vm->seen[cur->threads[i].pc] = vm->generation;
+			caps[0] = pos;
+			caps[1] = caps[2] = caps[3] = -1;
+			pike_add(vm, cur, 0, caps, pos);
+		}
+
+		if (cur->length == 0 || string[pos] == '\0')
+			break;
+
+		++vm->generation;
+		next->length = 0;
+		unsigned char c = string[pos];
+		for (i = 0; i < cur->length; ++i) {
+			PikeThread *t = &cur->threads[i];
+			/* Once there is a match, nothing that starts later can win. */
+			if (vm->found && t->caps[0] > vm->best[0])
+				continue;
+			if (byteset_has(&vm->sets[vm->prog[t->pc].x], c))
+				pike_add(vm, next, t->pc + 1, t->caps, pos + 1);
+		}
+
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	if (!vm->found)
+		return REG_NOMATCH;
+
+	match[0].rm_so = vm->best[0];
+	match[0].rm_eo = vm->best[1];
+	match[1].rm_so = vm->best[2];
+	match[1].rm_eo = vm->best[3];
+	return 0;
+}
+
+void pike_free(void *state)
+{
+	PikeVM *vm = state;
+	free(vm->prog);
+	free(vm->sets);
+	free(vm->lists[0].threads);
+	free(vm->lists[1].threads);
+	free(vm->seen);
+	free(vm);
+}
+
+
+#ifdef FREQ_HAVE_SCANNERS
+int generated_compile(void **state, const char *regex)
+{
+	size_t i;
+	for (i = 0; i < sizeof(gen_scanners) / sizeof(gen_scanners[0]); ++i) {
+		if (strcmp(gen_scanners[i].regex, regex) == 0) {
+			*state = (void *) &gen_scanners[i];
+			return 0;
+		}
+	}
+
+	return -2;
+}
+
+int generated_exec(void *state, const char *string, regmatch_t match[2])
+{
+	return ((const GenScanner *) state)->exec(string, match);
+}
+
+void generated_free(void *state)
+{
+	(void) state; /* the scanners are static; there is nothing to free */
+}
+#endif
+
+
+#ifdef FREQ_HAVE_PCRE2
+typedef struct {
+	pcre2_code *code;
+	pcre2_match_data *data;
+} Pcre2State;
+
+int pcre2_backend_compile(void **state, const char *regex)
+{
+	int error;
+	PCRE2_SIZE offset;
+	Pcre2State *s = malloc(sizeof(Pcre2State));
+	if (s == NULL) return -2;
+
+	s->code = pcre2_compile((PCRE2_SPTR) regex, PCRE2_ZERO_TERMINATED,
+			PCRE2_CASELESS | PCRE2_DOTALL, &error, &offset, NULL);
+	if (s->code == NULL) {
+		free(s);
+		return -2;
+	}
+
+	pcre2_jit_compile(s->code, PCRE2_JIT_COMPLETE);
+	s->data = pcre2_match_data_create_from_pattern(s->code, NULL);
+	*state = s;
+	return 0;
+}
+
+int pcre2_backend_exec(void *state, const char *string, regmatch_t match[2])
+{
+	Pcre2State *s = state;
+	int ret = pcre2_match(s->code, (PCRE2_SPTR) string, PCRE2_ZERO_TERMINATED, 0, 0,
+			s->data, NULL);
+	if (ret == PCRE2_ERROR_NOMATCH) return REG_NOMATCH;
+	if (ret < 0) return REG_ESPACE;
+
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(s->data);
+	match[0].rm_so = ovector[0];
+	match[0].rm_eo = ovector[1];
+	if (ret > 1 && ovector[2] != PCRE2_UNSET) {
+		match[1].rm_so = ovector[2];
+		match[1].rm_eo = ovector[3];
+	} else {
+		match[1].rm_so = match[1].rm_eo = -1;
+	}
+	return 0;
+}
+
+void pcre2_backend_free(void *state)
+{
+	Pcre2State *s = state;
+	pcre2_match_data_free(s->data);
+	pcre2_code_free(s->code);
+	free(s);
+}
+#endif
@@ -0,0 +1,143 @@
+/*
+ * FreqClass.c
+ *
+ * Searching a buffer for bytes that belong to a ByteSet, and classifying a
+ * buffer into membership bitmasks. A set is kept as a short list of byte ranges
+ * as well, so that SSE2 can test sixteen bytes at a time; sets with too many
+ * ranges fall back to a table lookup per byte.
+ *
+ * In order to use this file you must include FreqRegex.c.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CLASS_MAX_RANGES 8
+
+typedef struct {
+	ByteSet set;
+	int nranges; /* may exceed CLASS_MAX_RANGES, in which case lo and width are unused */
+	uint8_t lo[CLASS_MAX_RANGES];
+	uint8_t width[CLASS_MAX_RANGES]; /* highest byte in the range minus lo */
+} ByteClass;
+
+
+/*
+ * Initializes (cls) to search for the bytes in (set).
+ */
+void byteclass_init(ByteClass *cls, const ByteSet *set);
+
+/*
+ * Returns the index of the first byte of (buffer) that is in (cls), or (length)
+ * if there is none.
+ */
+uint64_t byteclass_find(const ByteClass *cls, const char *buffer, uint64_t length);
+
+/*
+ * Returns a mask in which bit k is set iff buffer[k] is in (cls), for the first
+ * (length) bytes of (buffer). (length) must be at most 64.
+ */
+uint64_t byteclass_mask(const ByteClass *cls, const char *buffer, size_t length);
+
+
+void byteclass_init(ByteClass *cls, const ByteSet *set)
+{
+	cls->set = *set;
+	cls->nranges = 0;
+
+	int c = 0, lo;
+	while (c < 256) {
+		while (c < 256 && !byteset_has(set, c))
+			++c;
+		if (c == 256) break;
+
+		lo = c;
+		while (c < 256 && byteset_has(set, c))
+			++c;
+
+		if (cls->nranges < CLASS_MAX_RANGES) {
+			cls->lo[cls->nranges] = lo;
+			cls->width[cls->nranges] = c - 1 - lo;
+		}
+		++cls->nranges;
+	}
+}
+
+uint64_t byteclass_find(const ByteClass *cls, const char *buffer, uint64_t length)
+{
+	uint64_t i = 0;
+
+	/* A single byte is what memchr() is for. */
+	if (cls->nranges == 1 && cls->width[0] == 0) {
+		const char *p = memchr(buffer, cls->lo[0], length);
+		return p ? (uint64_t) (p - buffer) : length;
+	}
+
+#ifdef __SSE2__
+	if (cls->nranges <= CLASS_MAX_RANGES) {
+		__m128i lo[CLASS_MAX_RANGES], width[CLASS_MAX_RANGES];
+		int r;
+		for (r = 0; r < cls->nranges; ++r) {
+			lo[r] = _mm_set1_epi8((char) cls->lo[r]);
+			width[r] = _mm_set1_epi8((char) cls->width[r]);
+		}
+
+		/* A byte c is in the range [lo, lo + width] iff (c - lo) <= width as an
+		 * unsigned byte, and x <= y iff min(x, y) == x.
+		 */
+		for (; i + 16 <= length; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (buffer + i));
+			__m128i hit = _mm_setzero_si128();
+			for (r = 0; r < cls->nranges; ++r) {
+				__m128i t = _mm_sub_epi8(v, lo[r]);
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(t, width[r]), t));
+			}
+
+			int mask = _mm_movemask_epi8(hit);
+			if (mask)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for (; i < length; ++i)
+		if (byteset_has(&cls->set, buffer[i]))
+			return i;
+
+	return length;
+}
+
+uint64_t byteclass_mask(const ByteClass *cls, const char *buffer, size_t length)
+{
+	uint64_t mask = 0;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	if (length == 64 && cls->nranges <= CLASS_MAX_RANGES) {
+		__m128i lo[CLASS_MAX_RANGES], width[CLASS_MAX_RANGES];
+		int r;
+		for (r = 0; r < cls->nranges; ++r) {
+			lo[r] = _mm_set1_epi8((char) cls->lo[r]);
+			width[r] = _mm_set1_epi8((char) cls->width[r]);
+		}
+
+		for (; i < 64; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (buffer + i));
+			__m128i hit = _mm_setzero_si128();
+			for (r = 0; r < cls->nranges; ++r) {
+				__m128i t = _mm_sub_epi8(v, lo[r]);
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(t, width[r]), t));
+			}
+			mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(hit) << i;
+		}
+		return mask;
+	}
+#endif
+
+	for (; i < length; ++i)
+		if (byteset_has(&cls->set, buffer[i]))
+			mask |= (uint64_t) 1 << i;
+
+	return mask;
+}
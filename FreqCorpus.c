@@ -0,0 +1,412 @@
+/*
+ * FreqCorpus.c
+ *
+ * A tokenized corpus: a text file split into words once, so that word n-grams
+ * can be counted again and again without reading or tokenizing the text. A
+ * corpus is two files:
+ *
+ * - The ID file holds a CorpusHeader and then one uint32_t per word of the
+ *   text, in the machine's byte order. It is read with mmap().
+ * - The vocabulary file holds one word per line. Word ID k is on line k,
+ *   counting from 0, and IDs are given in order of first appearance.
+ *
+ * Words are found by words_tokenize(), so counting a corpus gives the same
+ * results as find_n_words_for_file() on the text it came from.
+ *
+ * In order to use this file you must include fcntl.h, sys/mman.h, sys/stat.h,
+ * unistd.h, FreqHash.c and FreqWords.c.
+ */
+
+#define CORPUS_MAGIC "FQID"
+#define CORPUS_VERSION 1
+
+/* The text did not end in a word. find_n_words_for_file() counts one more
+ * n-gram in that case, so the corpus has to remember it.
+ */
+#define CORPUS_TRAILING 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t length; /* number of word IDs that follow */
+} CorpusHeader;
+
+typedef struct {
+	const uint32_t *ids;
+	uint64_t length;
+	bool trailing;
+
+	char **vocab; /* the word for each ID */
+	size_t vocab_length;
+
+	void *map;
+	size_t map_length;
+	char *vocab_buffer;
+} Corpus;
+
+/* Counts of ID n-grams, by open addressing. */
+typedef struct {
+	uint32_t *keys; /* n IDs per slot */
+	uint64_t *counts; /* 0 for an empty slot */
+	size_t capacity; /* a power of 2 */
+	size_t length;
+	int n;
+} IdTable;
+
+
+/*
+ * Splits the first (length) bytes of (buffer) into words and writes them as a
+ * corpus to (ids_file) and (vocab_file).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File write error, or out of memory.
+ */
+int corpus_write(const char *buffer, uint64_t length, const char *ids_file,
+		const char *vocab_file);
+
+/*
+ * Opens the corpus in (ids_file) and (vocab_file) into (corpus), which must be
+ * closed with corpus_close().
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File read error, or out of memory.
+ * -2: (ids_file) is not a corpus, or does not match (vocab_file).
+ */
+int corpus_open(Corpus *corpus, const char *ids_file, const char *vocab_file);
+
+void corpus_close(Corpus *corpus);
+
+/*
+ * Adds every n-gram of (wordcount) words in (corpus) to (hash), each counting
+ * as (multiplier), the way find_n_words_for_file() does.
+ */
+int corpus_count_words(Hash *hash, const Corpus *corpus, int wordcount, double multiplier);
+
+int idtable_init(IdTable *table, int n);
+int idtable_inc(IdTable *table, const uint32_t *key);
+int idtable_grow(IdTable *table);
+size_t idtable_hash(const uint32_t *key, int n);
+
+/*
+ * Puts the words of (key) into (*buffer), separated by spaces, with a space on
+ * the end if (trailing_space) is true. (*buffer) is grown as needed.
+ */
+int corpus_key(char **buffer, size_t *capacity, const Corpus *corpus,
+		const uint32_t *key, int n, bool trailing_space);
+
+
+int corpus_write(const char *buffer, uint64_t length, const char *ids_file,
+		const char *vocab_file)
+{
+	WordList words;
+	if (words_tokenize(&words, buffer, length))
+		return -1;
+
+	FILE *ids = fopen(ids_file, "wb");
+	FILE *vocab = fopen(vocab_file, "w");
+	Hash seen;
+	hash_init(&seen);
+	int ret = ids && vocab ? 0 : -1;
+
+	CorpusHeader header;
+	memset(&header, 0, sizeof(CorpusHeader));
+	memcpy(header.magic, CORPUS_MAGIC, 4);
+	header.version = CORPUS_VERSION;
+	header.length = words.length;
+	uint64_t tail = words.length ? words.offsets[2 * words.length - 1] : 0;
+	if (tail < length)
+		header.flags |= CORPUS_TRAILING;
+	if (ret == 0 && fwrite(&header, sizeof(CorpusHeader), 1, ids) != 1)
+		ret = -1;
+
+	char *word = NULL;
+	size_t capacity = 0, k;
+	uint32_t next_id = 0;
+	for (k = 0; k < words.length && ret == 0; ++k) {
+		size_t word_length = words.offsets[2*k + 1] - words.offsets[2*k];
+		if (word_length + 1 > capacity) {
+			capacity = 2 * (word_length + 1);
+			char *grown = realloc(word, capacity);
+			if (grown == NULL) {
+				ret = -1;
+				break;
+			}
+			word = grown;
+		}
+		memcpy(word, buffer + words.offsets[2*k], word_length);
+		word[word_length] = '\0';
+
+		long found = hash_get(seen, word);
+		uint32_t id;
+		if (found >= 0) {
+			id = found;
+		} else {
+			id = next_id++;
+			hash_put(&seen, word, id);
+			fprintf(vocab, "%s\n", word);
+		}
+
+		if (fwrite(&id, sizeof(uint32_t), 1, ids) != 1)
+			ret = -1;
+	}
+
+	free(word);
+	hash_clear(&seen);
+	words_free(&words);
+	if (ids && fclose(ids)) ret = -1;
+	if (vocab && fclose(vocab)) ret = -1;
+	return ret;
+}
+
+int corpus_open(Corpus *corpus, const char *ids_file, const char *vocab_file)
+{
+	memset(corpus, 0, sizeof(Corpus));
+
+	int fd = open(ids_file, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(CorpusHeader)) {
+		close(fd);
+		return -2;
+	}
+
+	corpus->map_length = st.st_size;
+	corpus->map = mmap(NULL, corpus->map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (corpus->map == MAP_FAILED) {
+		corpus->map = NULL;
+		return -1;
+	}
+
+	const CorpusHeader *header = corpus->map;
+	if (memcmp(header->magic, CORPUS_MAGIC, 4) || header->version != CORPUS_VERSION ||
+			header->length != (corpus->map_length - sizeof(CorpusHeader)) / sizeof(uint32_t)) {
+		corpus_close(corpus);
+		return -2;
+	}
+	corpus->ids = (const uint32_t *) (header + 1);
+	corpus->length = header->length;
+	corpus->trailing = header->flags & CORPUS_TRAILING;
+	madvise(corpus->map, corpus->map_length, MADV_SEQUENTIAL);
+
+	/* Read the vocabulary, and point each entry at its line. */
+	FILE *vocab = fopen(vocab_file, "rb");
+	if (vocab == NULL) {
+		corpus_close(corpus);
+		return -1;
+	}
+	fseek(vocab, 0, SEEK_END);
+	long size = ftell(vocab);
+	fseek(vocab, 0, SEEK_SET);
+	corpus->vocab_buffer = malloc(size + 1);
+	if (corpus->vocab_buffer == NULL ||
+			fread(corpus->vocab_buffer, 1, size, vocab) != (size_t) size) {
+		fclose(vocab);
+		corpus_close(corpus);
+		return -1;
+	}
+	fclose(vocab);
+	corpus->vocab_buffer[size] = '\0';
+
+	long i;
+	for (i = 0; i < size; ++i)
+		if (corpus->vocab_buffer[i] == '\n')
+			++corpus->vocab_length;
+	corpus->vocab = malloc(sizeof(char *) * (corpus->vocab_length + 1));
+	if (corpus->vocab == NULL) {
+		corpus_close(corpus);
+		return -1;
+	}
+
+	char *line = corpus->vocab_buffer;
+	size_t k = 0;
+	for (i = 0; i < size; ++i) {
+		if (corpus->vocab_buffer[i] == '\n') {
+			corpus->vocab_buffer[i] = '\0';
+			corpus->vocab[k++] = line;
+			line = corpus->vocab_buffer + i + 1;
+		}
+	}
+
+	/* Every ID must have a word. */
+	uint64_t j;
+	for (j = 0; j < corpus->length; ++j) {
+		if (corpus->ids[j] >= corpus->vocab_length) {
+			corpus_close(corpus);
+			return -2;
+		}
+	}
+
+	return 0;
+}
+
+void corpus_close(Corpus *corpus)
+{
+	if (corpus->map)
+		munmap(corpus->map, corpus->map_length);
+	free(corpus->vocab);
+	free(corpus->vocab_buffer);
+	memset(corpus, 0, sizeof(Corpus));
+}
+
+int corpus_count_words(Hash *hash, const Corpus *corpus, int wordcount, double multiplier)
+{
+	char *key = NULL;
+	size_t capacity = 0, k;
+	uint64_t t;
+	int ret = 0;
+
+	/* The n-grams are counted by ID, and only the distinct ones are turned
+	 * into strings.
+	 */
+	if (wordcount == 1) {
+		uint64_t *counts = calloc(corpus->vocab_length, sizeof(uint64_t));
+		if (counts == NULL && corpus->vocab_length) return -1;
+		for (t = 0; t < corpus->length; ++t)
+			++counts[corpus->ids[t]];
+		for (k = 0; k < corpus->vocab_length; ++k)
+			if (counts[k])
+				hash_inc(hash, corpus->vocab[k], counts[k] * multiplier);
+		free(counts);
+	} else if (corpus->length >= (uint64_t) wordcount) {
+		IdTable table;
+		if (idtable_init(&table, wordcount)) return -1;
+		for (t = 0; t + wordcount <= corpus->length && ret == 0; ++t)
+			ret = idtable_inc(&table, corpus->ids + t);
+
+		for (k = 0; k < table.capacity && ret == 0; ++k) {
+			if (table.counts[k] == 0) continue;
+			ret = corpus_key(&key, &capacity, corpus, table.keys + k * wordcount,
+					wordcount, false);
+			if (ret == 0)
+				hash_inc(hash, key, table.counts[k] * multiplier);
+		}
+		free(table.keys);
+		free(table.counts);
+	}
+
+	/* A text that does not end in a word has one more n-gram, made of its
+	 * last (wordcount - 1) words and a space.
+	 */
+	if (ret == 0 && corpus->trailing && corpus->length + 1 >= (uint64_t) wordcount) {
+		ret = corpus_key(&key, &capacity, corpus,
+				corpus->ids + corpus->length + 1 - wordcount, wordcount - 1,
+				wordcount > 1);
+		if (ret == 0)
+			hash_inc(hash, key, multiplier);
+	}
+
+	free(key);
+	return ret;
+}
+
+int corpus_key(char **buffer, size_t *capacity, const Corpus *corpus,
+		const uint32_t *key, int n, bool trailing_space)
+{
+	size_t needed = n + 1, j = 0;
+	int k;
+	for (k = 0; k < n; ++k)
+		needed += strlen(corpus->vocab[key[k]]);
+
+	if (needed > *capacity) {
+		char *grown = realloc(*buffer, 2 * needed);
+		if (grown == NULL) return -1;
+		*buffer = grown;
+		*capacity = 2 * needed;
+	}
+
+	for (k = 0; k < n; ++k) {
+		if (k > 0) (*buffer)[j++] = ' ';
+		size_t length = strlen(corpus->vocab[key[k]]);
+		memcpy(*buffer + j, corpus->vocab[key[k]], length);
+		j += length;
+	}
+	if (trailing_space)
+		(*buffer)[j++] = ' ';
+	(*buffer)[j] = '\0';
+	return 0;
+}
+
+int idtable_init(IdTable *table, int n)
+{
+	table->n = n;
+	table->length = 0;
+	table->capacity = 1024;
+	table->keys = malloc(sizeof(uint32_t) * n * table->capacity);
+	table->counts = calloc(table->capacity, sizeof(uint64_t));
+	if (table->keys == NULL || table->counts == NULL) {
+		free(table->keys);
+		free(table->counts);
+		return -1;
+	}
+	return 0;
+}
+
+size_t idtable_hash(const uint32_t *key, int n)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int k;
+	for (k = 0; k < n; ++k) {
+		x ^= key[k];
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 32;
+	}
+	return x;
+}
+
+int idtable_inc(IdTable *table, const uint32_t *key)
+{
+	size_t mask = table->capacity - 1;
+	size_t i = idtable_hash(key, table->n) & mask;
+	size_t bytes = sizeof(uint32_t) * table->n;
+
+	while (table->counts[i]) {
+		if (memcmp(table->keys + i * table->n, key, bytes) == 0) {
+			++table->counts[i];
+			return 0;
+		}
+		i = (i + 1) & mask;
+	}
+
+	memcpy(table->keys + i * table->n, key, bytes);
+	table->counts[i] = 1;
+	if (++table->length * 2 > table->capacity)
+		return idtable_grow(table);
+	return 0;
+}
+
+int idtable_grow(IdTable *table)
+{
+	IdTable bigger;
+	bigger.n = table->n;
+	bigger.length = table->length;
+	bigger.capacity = table->capacity * 2;
+	bigger.keys = malloc(sizeof(uint32_t) * bigger.n * bigger.capacity);
+	bigger.counts = calloc(bigger.capacity, sizeof(uint64_t));
+	if (bigger.keys == NULL || bigger.counts == NULL) {
+		free(bigger.keys);
+		free(bigger.counts);
+		return -1;
+	}
+
+	size_t k, mask = bigger.capacity - 1;
+	for (k = 0; k < table->capacity; ++k) {
+		if (table->counts[k] == 0) continue;
+		const uint32_t *key = table->keys + k * table->n;
+		size_t i = idtable_hash(key, table->n) & mask;
+		while (bigger.counts[i])
+			i = (i + 1) & mask;
+		memcpy(bigger.keys + i * bigger.n, key, sizeof(uint32_t) * bigger.n);
+		bigger.counts[i] = table->counts[k];
+	}
+
+	free(table->keys);
+	free(table->counts);
+	*table = bigger;
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * FreqDedup.c
+ *
+ * Finds the texts, and the blocks of texts, that have been seen before, so
+ * that a corpus with copies of the same documents counts each one once. Each
+ * text and each block is known by a 64-bit fingerprint of its bytes; two
+ * different ones share a fingerprint so rarely that it is not checked for.
+ *
+ * The first text or block with a fingerprint is kept, and later ones are
+ * skipped, so which copy is counted depends only on the order in which the
+ * texts are given, not on the threads that count them. The blocks are either
+ * of a fixed size, or cut where the content says: a gear hash rolls over the
+ * bytes, and a block ends after a newline where the top DEDUP_CHUNK_BITS of
+ * the hash are 0. A block then ends at the same line wherever its text sits in
+ * a file, so a copy of a document is found even when what comes before it
+ * differs, and the matches of a block that is kept are not cut off halfway
+ * through a line.
+ *
+ * In order to use this file you must include stdbool, stdint, stdlib and
+ * string.h, and FreqHash.c.
+ */
+
+#define DEDUP_MIN_CHUNK (2 << 10)
+#define DEDUP_MAX_CHUNK (64 << 10)
+#define DEDUP_CHUNK_BITS 7 /* a cut at about one line in 128 */
+#define DEDUP_INITIAL_SLOTS 1024
+
+typedef enum {
+	DEDUP_TEXTS, /* only whole texts */
+	DEDUP_BLOCKS, /* and blocks of (block_size) bytes */
+	DEDUP_CHUNKS /* and blocks cut by content */
+} DedupMode;
+
+/* The parts of a text that are counted. */
+typedef struct {
+	uint64_t *ranges; /* range k runs from ranges[2k] up to ranges[2k+1] */
+	size_t length; /* number of ranges */
+	size_t capacity;
+} DedupKept;
+
+typedef struct {
+	DedupMode mode;
+	uint64_t block_size;
+
+	/* The fingerprints seen so far, in open addressing, where 0 is empty. */
+	uint64_t *slots;
+	size_t nslots, nseen;
+
+	Hash names; /* the name of each text, and 1 + its index in (texts) */
+	DedupKept *texts;
+	size_t ntexts, texts_capacity;
+
+	uint64_t bytes, skipped_bytes; /* in every text given, and in those skipped */
+	uint64_t skipped_texts; /* whole texts that were copies */
+} Dedup;
+
+
+/*
+ * Makes (dedup) with nothing seen, to cut texts into blocks as (mode) and
+ * (block_size) say. Returns -1 if out of memory. It must be freed with
+ * dedup_free().
+ */
+int dedup_init(Dedup *dedup, DedupMode mode, uint64_t block_size);
+
+void dedup_free(Dedup *dedup);
+
+/*
+ * Finds which parts of the (length) bytes of (text), which is called (name),
+ * have not been seen before, and notes them in (dedup) as the parts of (name)
+ * to count. A name that has been given before is left as it was. Returns -1
+ * if out of memory.
+ */
+int dedup_text(Dedup *dedup, const char *name, const char *text, uint64_t length);
+
+/*
+ * Returns the parts of (name) to count, or NULL if dedup_text() has not been
+ * given it. A text that was a copy of an earlier one has no parts.
+ */
+const DedupKept * dedup_find(const Dedup *dedup, const char *name);
+
+/*
+ * Notes (fingerprint) as seen. Returns 1 if it had been seen before, 0 if not,
+ * or -1 if out of memory.
+ */
+int dedup_seen(Dedup *dedup, uint64_t fingerprint);
+
+/*
+ * Returns a fingerprint of the (length) bytes of (bytes). Texts and blocks
+ * use different values of (seed), so that a text of one block does not find
+ * itself.
+ */
+uint64_t dedup_fingerprint(const char *bytes, uint64_t length, uint64_t seed);
+
+/*
+ * Returns the length of the block that starts at (text), which has (length)
+ * bytes left.
+ */
+uint64_t dedup_block(const Dedup *dedup, const char *text, uint64_t length);
+
+int dedup_keep(DedupKept *kept, uint64_t start, uint64_t end);
+uint64_t dedup_mix(uint64_t x);
+
+
+int dedup_init(Dedup *dedup, DedupMode mode, uint64_t block_size)
+{
+	dedup->mode = mode;
+	dedup->block_size = block_size > 0 ? block_size : DEDUP_MAX_CHUNK;
+	dedup->nslots = DEDUP_INITIAL_SLOTS;
+	dedup->nseen = 0;
+	dedup->slots = calloc(dedup->nslots, sizeof(uint64_t));
+	dedup->texts = NULL;
+	dedup->ntexts = dedup->texts_capacity = 0;
+	dedup->bytes = dedup->skipped_bytes = dedup->skipped_texts = 0;
+	hash_init(&dedup->names);
+	return dedup->slots ? 0 : -1;
+}
+
+void dedup_free(Dedup *dedup)
+{
+	size_t i;
+	for (i = 0; i < dedup->ntexts; ++i)
+		free(dedup->texts[i].ranges);
+	free(dedup->texts);
+	free(dedup->slots);
+	hash_clear(&dedup->names);
+	dedup->texts = NULL;
+	dedup->slots = NULL;
+	dedup->ntexts = dedup->texts_capacity = dedup->nslots = dedup->nseen = 0;
+}
+
+int dedup_text(Dedup *dedup, const char *name, const char *text, uint64_t length)
+{
+	uint64_t at, block;
+	int seen;
+
+	if (dedup_find(dedup, name))
+		return 0;
+
+	if (dedup->ntexts == dedup->texts_capacity) {
+		size_t capacity = dedup->texts_capacity ? dedup->texts_capacity * 2 : 64;
+		DedupKept *texts = realloc(dedup->texts, sizeof(DedupKept) * capacity);
+		if (texts == NULL) return -1;
+		dedup->texts = texts;
+		dedup->texts_capacity = capacity;
+	}
+	DedupKept *kept = &dedup->texts[dedup->ntexts];
+	kept->ranges = NULL;
+	kept->length = kept->capacity = 0;
+	dedup->bytes += length;
+
+	/* A copy of a whole text is skipped without cutting it into blocks. */
+	seen = dedup_seen(dedup, dedup_fingerprint(text, length, 1));
+	if (seen < 0)
+		return -1;
+	if (seen) {
+		dedup->skipped_bytes += length;
+		++dedup->skipped_texts;
+	}
+
+	for (at = 0; at < length && !seen; at += block) {
+		int copy = 0;
+		if (dedup->mode == DEDUP_TEXTS) {
+			block = length;
+		} else {
+			block = dedup_block(dedup, text + at, length - at);
+			copy = dedup_seen(dedup, dedup_fingerprint(text + at, block, 0));
+		}
+		if (copy < 0 || (copy == 0 && dedup_keep(kept, at, at + block))) {
+			free(kept->ranges);
+			return -1;
+		}
+		if (copy)
+			dedup->skipped_bytes += block;
+	}
+
+	++dedup->ntexts;
+	hash_put(&dedup->names, name, dedup->ntexts);
+	return 0;
+}
+
+const DedupKept * dedup_find(const Dedup *dedup, const char *name)
+{
+	Pair *pair = hash_find(dedup->names, name, hash_function(name));
+	return pair ? &dedup->texts[(size_t) pair->value - 1] : NULL;
+}
+
+int dedup_seen(Dedup *dedup, uint64_t fingerprint)
+{
+	size_t i;
+
+	if (fingerprint == 0)
+		fingerprint = 1;
+
+	/* Keep the slots no more than half full. */
+	if (2 * (dedup->nseen + 1) > dedup->nslots) {
+		size_t nslots = dedup->nslots * 2;
+		uint64_t *slots = calloc(nslots, sizeof(uint64_t));
+		if (slots == NULL) return -1;
+		for (i = 0; i < dedup->nslots; ++i) {
+			if (dedup->slots[i] == 0)
+				continue;
+			size_t j = dedup->slots[i] & (nslots - 1);
+			while (slots[j])
+				j = (j + 1) & (nslots - 1);
+			slots[j] = dedup->slots[i];
+		}
+		free(dedup->slots);
+		dedup->slots = slots;
+		dedup->nslots = nslots;
+	}
+
+	for (i = fingerprint & (dedup->nslots - 1); dedup->slots[i];
+			i = (i + 1) & (dedup->nslots - 1))
+		if (dedup->slots[i] == fingerprint)
+			return 1;
+	dedup->slots[i] = fingerprint;
+	++dedup->nseen;
+	return 0;
+}
+
+uint64_t dedup_mix(uint64_t x)
+{
+	/* The finalizer of splitmix64. */
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+uint64_t dedup_fingerprint(const char *bytes, uint64_t length, uint64_t seed)
+{
+	uint64_t h = dedup_mix(seed ^ length), word, i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ dedup_mix(word + i)) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	word = 0;
+	memcpy(&word, bytes + i, length - i);
+	return dedup_mix(h ^ dedup_mix(word + i));
+}
+
+uint64_t dedup_block(const Dedup *dedup, const char *text, uint64_t length)
+{
+	uint64_t i, h = 0;
+
+	if (dedup->mode != DEDUP_CHUNKS)
+		return length < dedup->block_size ? length : dedup->block_size;
+
+	/* The hash shifts one bit a byte, so its top bits depend only on the last
+	 * 64 bytes, and it need not be started again for each block.
+	 */
+	for (i = 0; i < length && i < DEDUP_MAX_CHUNK; ++i) {
+		h = (h << 1) + dedup_mix((unsigned char) text[i]);
+		if (i + 1 >= DEDUP_MIN_CHUNK && text[i] == '\n' &&
+				h >> (64 - DEDUP_CHUNK_BITS) == 0)
+			return i + 1;
+	}
+	return i;
+}
+
+int dedup_keep(DedupKept *kept, uint64_t start, uint64_t end)
+{
+	/* A block that follows the last kept one only makes it longer. */
+	if (kept->length > 0 && kept->ranges[2 * kept->length - 1] == start) {
+		kept->ranges[2 * kept->length - 1] = end;
+		return 0;
+	}
+
+	if (kept->length == kept->capacity) {
+		size_t capacity = kept->capacity ? kept->capacity * 2 : 8;
+		uint64_t *ranges = realloc(kept->ranges, sizeof(uint64_t) * 2 * capacity);
+		if (ranges == NULL) return -1;
+		kept->ranges = ranges;
+		kept->capacity = capacity;
+	}
+	kept->ranges[2 * kept->length] = start;
+	kept->ranges[2 * kept->length + 1] = end;
+	++kept->length;
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * FreqDense.c
+ *
+ * A counting table for n-grams over a small set of bytes. Every possible n-gram
+ * has its own cell, so counting one is an array increment instead of a hash
+ * lookup. The cells are added to a Hash once counting is done.
+ *
+ * In order to use this file you must include FreqHash.c and FreqRegex.c.
+ */
+
+/* The largest table worth allocating, in cells. */
+#define DENSE_MAX_CELLS (1 << 20)
+
+typedef struct {
+	double *cells;
+	size_t length; /* number of cells, size^n */
+	int n;
+	int size; /* number of bytes in the set */
+	int rank[256]; /* position of each byte in the set, or -1 */
+	unsigned char bytes[256]; /* the byte at each position */
+} DenseTable;
+
+
+/*
+ * Allocates (dense) for n-grams of (n) bytes from (set).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: The table would be larger than DENSE_MAX_CELLS, or allocation failed.
+ */
+int dense_init(DenseTable *dense, const ByteSet *set, int n);
+
+/*
+ * Increases the cell for the (n) bytes at (key) by (value). Every byte must be
+ * in the set that (dense) was created with.
+ */
+void dense_inc(DenseTable *dense, const char *key, double value);
+
+/*
+ * Adds every nonzero cell of (dense) to (hash), then frees (dense).
+ */
+int dense_flush(DenseTable *dense, Hash *hash);
+
+
+int dense_init(DenseTable *dense, const ByteSet *set, int n)
+{
+	int c;
+	dense->size = 0;
+	for (c = 0; c < 256; ++c) {
+		if (byteset_has(set, c)) {
+			dense->rank[c] = dense->size;
+			dense->bytes[dense->size++] = c;
+		} else {
+			dense->rank[c] = -1;
+		}
+	}
+
+	dense->n = n;
+	dense->length = 1;
+	for (c = 0; c < n; ++c) {
+		dense->length *= dense->size;
+		if (dense->length > DENSE_MAX_CELLS)
+			return -1;
+	}
+
+	dense->cells = calloc(dense->length, sizeof(double));
+	return dense->cells ? 0 : -1;
+}
+
+void dense_inc(DenseTable *dense, const char *key, double value)
+{
+	size_t index = 0;
+	int k;
+	for (k = 0; k < dense->n; ++k)
+		index = index * dense->size + dense->rank[(unsigned char) key[k]];
+
+	dense->cells[index] += value;
+}
+
+int dense_flush(DenseTable *dense, Hash *hash)
+{
+	char key[dense->n + 1];
+	size_t i, index;
+	int k;
+
+	key[dense->n] = '\0';
+	for (i = 0; i < dense->length; ++i) {
+		if (dense->cells[i] == 0)
+			continue;
+
+		index = i;
+		for (k = dense->n - 1; k >= 0; --k) {
+			key[k] = dense->bytes[index % dense->size];
+			index /= dense->size;
+		}
+		hash_inc(hash, key, dense->cells[i]);
+	}
+
+	free(dense->cells);
+	dense->cells = NULL;
+	return 0;
+}
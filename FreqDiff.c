@@ -0,0 +1,215 @@
+/*
+ * FreqDiff.c
+ *
+ * Compares two tables of counts, such as the counts of two corpora or of one
+ * corpus at two times, key by key. The tables are joined on their hashes:
+ * each key of one is looked up in the other with the hash value it already
+ * has, so the join takes one pass over each table and needs no sort. The
+ * pairs of each table are first gathered into an array, since a table can
+ * have many more buckets than keys.
+ *
+ * Each key gets the difference between its counts, the ratio of its relative
+ * frequencies, and its keyness: the log-likelihood G2 of Rayson and Garside,
+ * signed positive when the key is relatively more frequent in the second
+ * table. G2 is meant for raw counts; on weighted tables it still ranks the
+ * keys, but is no longer a chi-squared statistic.
+ *
+ * In order to use this file you must include math.h, stdlib and string.h, and
+ * FreqHash.c.
+ */
+
+typedef struct {
+	const char *key;
+	double a, b; /* the count in each table, 0 if it is not there */
+	double delta; /* b - a */
+	double ratio; /* (b / total_b) / (a / total_a), or INFINITY if a is 0 */
+	double keyness;
+} DiffRow;
+
+typedef struct {
+	double total_a, total_b;
+	size_t only_a, only_b, both; /* how many keys are in one table or both */
+} DiffSummary;
+
+
+/*
+ * Calls (f) with a DiffRow for every key of (a) and (b), and (arg): first the
+ * keys of (a), then those that are only in (b). If (f) returns a nonzero
+ * value, this function stops and returns that value. If (summary) is not
+ * NULL, it gets the totals and the number of keys of each kind.
+ */
+int diff_tables(Hash a, Hash b, int (*f)(const DiffRow *row, void *arg), void *arg,
+		DiffSummary *summary);
+
+/*
+ * Puts the (n) keys of (a) and (b) with the largest keyness, in either
+ * direction, into (rows), from the largest down, and their number into
+ * (length). The rows must be freed with free(). Returns -1 if out of memory.
+ */
+int diff_top(Hash a, Hash b, DiffRow **rows, size_t *length, size_t n,
+		DiffSummary *summary);
+
+/*
+ * Puts a pointer to each pair of (hash) into (pairs), which must be freed with
+ * free(), and the sum of their values into (total). Returns -1 if out of
+ * memory.
+ */
+int diff_gather(Hash hash, const Pair ***pairs, double *total);
+
+void diff_row(DiffRow *row, const char *key, double a, double b, double total_a,
+		double total_b);
+int diff_row_comparator(const void *x, const void *y);
+int diff_top_add(const DiffRow *row, void *arg);
+
+/* The rows that diff_top() has kept so far, as a heap with the least first. */
+typedef struct {
+	DiffRow *rows;
+	size_t length, n;
+} DiffHeap;
+
+
+int diff_tables(Hash a, Hash b, int (*f)(const DiffRow *row, void *arg), void *arg,
+		DiffSummary *summary)
+{
+	DiffSummary s;
+	DiffRow row;
+	const Pair **pairs_a, **pairs_b;
+	size_t i;
+	int ret = 0;
+
+	if (diff_gather(a, &pairs_a, &s.total_a))
+		return -1;
+	if (diff_gather(b, &pairs_b, &s.total_b)) {
+		free(pairs_a);
+		return -1;
+	}
+	s.only_a = s.only_b = s.both = 0;
+
+	for (i = 0; i < a.count && ret == 0; ++i) {
+		const Pair *pa = pairs_a[i];
+		const Pair *pb = hash_find(b, pa->key, pa->hashval);
+		if (pb) ++s.both;
+		else ++s.only_a;
+		diff_row(&row, pa->key, pa->value, pb ? pb->value : 0, s.total_a, s.total_b);
+		ret = (*f)(&row, arg);
+	}
+
+	for (i = 0; i < b.count && ret == 0; ++i) {
+		const Pair *pb = pairs_b[i];
+		if (hash_find(a, pb->key, pb->hashval))
+			continue;
+		++s.only_b;
+		diff_row(&row, pb->key, 0, pb->value, s.total_a, s.total_b);
+		ret = (*f)(&row, arg);
+	}
+
+	if (summary) *summary = s;
+	free(pairs_a);
+	free(pairs_b);
+	return ret;
+}
+
+int diff_top(Hash a, Hash b, DiffRow **rows, size_t *length, size_t n,
+		DiffSummary *summary)
+{
+	DiffHeap heap;
+	heap.rows = malloc(sizeof(DiffRow) * (n ? n : 1));
+	if (heap.rows == NULL) return -1;
+	heap.length = 0;
+	heap.n = n;
+
+	if (diff_tables(a, b, diff_top_add, &heap, summary)) {
+		free(heap.rows);
+		return -1;
+	}
+
+	qsort(heap.rows, heap.length, sizeof(DiffRow), diff_row_comparator);
+	*rows = heap.rows;
+	*length = heap.length;
+	return 0;
+}
+
+int diff_top_add(const DiffRow *row, void *arg)
+{
+	DiffHeap *heap = arg;
+	size_t i, child;
+
+	if (heap->n == 0)
+		return 0;
+
+	/* Sift the row up from the end, or, if the heap is full and the row beats
+	 * the least one kept, down from the top in its place.
+	 */
+	if (heap->length < heap->n) {
+		i = heap->length++;
+		while (i > 0 && diff_row_comparator(row, &heap->rows[(i - 1) / 2]) > 0) {
+			heap->rows[i] = heap->rows[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap->rows[i] = *row;
+		return 0;
+	}
+
+	if (diff_row_comparator(row, &heap->rows[0]) >= 0)
+		return 0;
+
+	for (i = 0; (child = 2 * i + 1) < heap->length; i = child) {
+		if (child + 1 < heap->length &&
+				diff_row_comparator(&heap->rows[child + 1], &heap->rows[child]) > 0)
+			++child;
+		if (diff_row_comparator(row, &heap->rows[child]) >= 0)
+			break;
+		heap->rows[i] = heap->rows[child];
+	}
+	heap->rows[i] = *row;
+	return 0;
+}
+
+int diff_gather(Hash hash, const Pair ***pairs, double *total)
+{
+	size_t i, j, k = 0;
+
+	*pairs = malloc(sizeof(Pair *) * (hash.count ? hash.count : 1));
+	if (*pairs == NULL) return -1;
+
+	*total = 0;
+	for (i = 0; i < hash.length; ++i) {
+		for (j = 0; j < hash.buckets[i].length; ++j) {
+			(*pairs)[k++] = &hash.buckets[i].pairs[j];
+			*total += hash.buckets[i].pairs[j].value;
+		}
+	}
+	return 0;
+}
+
+void diff_row(DiffRow *row, const char *key, double a, double b, double total_a,
+		double total_b)
+{
+	double expected_a = total_a * (a + b) / (total_a + total_b);
+	double expected_b = total_b * (a + b) / (total_a + total_b);
+	double g2 = 0;
+
+	if (a > 0) g2 += a * log(a / expected_a);
+	if (b > 0) g2 += b * log(b / expected_b);
+	g2 *= 2;
+
+	row->key = key;
+	row->a = a;
+	row->b = b;
+	row->delta = b - a;
+	row->ratio = a > 0 ? (b / total_b) / (a / total_a) : INFINITY;
+	row->keyness = b * total_a >= a * total_b ? g2 : -g2;
+}
+
+/* Orders rows from the largest keyness, in either direction, down, and then
+ * by key so that the order is the same every time.
+ */
+int diff_row_comparator(const void *x, const void *y)
+{
+	const DiffRow *xr = (const DiffRow *) x;
+	const DiffRow *yr = (const DiffRow *) y;
+
+	if (fabs(xr->keyness) > fabs(yr->keyness)) return -1;
+	else if (fabs(xr->keyness) < fabs(yr->keyness)) return 1;
+	else return strcmp(xr->key, yr->key);
+}
@@ -0,0 +1,261 @@
+/*
+ * FreqDir.c
+ *
+ * Finds the files in a tree of directories, such as a corpus with a directory
+ * for each kind of text, and how much each one counts. The directories are
+ * listed at the same time on a FreqPool, since a tree of thousands of small
+ * documents spends most of its time waiting on the file system.
+ *
+ * A directory that holds a file named DIR_WEIGHT_FILE with a number in it
+ * gives that weight to every file below it, until a directory further down
+ * gives another; a weight of 0 leaves the directory out. The weights of a
+ * corpus thus live next to its texts, instead of in a table in the program.
+ * Hidden files and the FreqNorm.c caches are skipped.
+ *
+ * In order to use this file you must include dirent.h, pthread.h, stdint,
+ * stdio, stdlib, string.h and sys/stat.h, and FreqNorm.c and FreqPool.c.
+ */
+
+#define DIR_WEIGHT_FILE ".freqweight"
+
+typedef struct {
+	char *path;
+	int weight;
+	uint64_t size;
+} DirFile;
+
+/* What the tasks of one dir_walk() share. */
+typedef struct {
+	FreqPool pool;
+	pthread_mutex_t lock; /* guards everything below */
+	DirFile *files;
+	size_t length, capacity;
+	int error;
+} DirWalk;
+
+/* One directory to list. */
+typedef struct {
+	DirWalk *walk;
+	char *path;
+	int weight;
+} DirTask;
+
+
+/*
+ * Finds every file under the (nroots) directories in (roots) on (nthreads)
+ * threads, and puts them in (files), sorted by path so that the order does not
+ * depend on the threads. A root can also be a file, which counts with a weight
+ * of 1. The array must be freed with dir_files_free().
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: A directory could not be read, or out of memory.
+ */
+int dir_walk(DirFile **files, size_t *length, const char **roots, size_t nroots,
+		int nthreads);
+
+void dir_files_free(DirFile *files, size_t length);
+
+/*
+ * Returns the weight that (path) gives to the files below it, which is
+ * (inherited) unless it has a DIR_WEIGHT_FILE.
+ */
+int dir_weight(const char *path, int inherited);
+
+/*
+ * Queues the directory (path) to be listed. Takes ownership of (path).
+ */
+int dir_submit(DirWalk *walk, char *path, int weight);
+
+int dir_add(DirWalk *walk, char *path, int weight, uint64_t size);
+
+/*
+ * Records that the walk failed. Returns -1.
+ */
+int dir_fail(DirWalk *walk);
+
+void dir_task_run(void *arg);
+int dir_file_comparator(const void *x, const void *y);
+bool dir_skip(const char *name);
+
+
+int dir_walk(DirFile **files, size_t *length, const char **roots, size_t nroots,
+		int nthreads)
+{
+	DirWalk walk;
+	struct stat st;
+	size_t i;
+
+	walk.files = NULL;
+	walk.length = walk.capacity = 0;
+	walk.error = 0;
+	pthread_mutex_init(&walk.lock, NULL);
+	if (pool_init(&walk.pool, nthreads < 1 ? 1 : nthreads)) {
+		pthread_mutex_destroy(&walk.lock);
+		return -1;
+	}
+
+	for (i = 0; i < nroots; ++i) {
+		char *path = malloc(strlen(roots[i]) + 1);
+		if (path == NULL || stat(roots[i], &st)) {
+			free(path);
+			dir_fail(&walk);
+			break;
+		}
+		strcpy(path, roots[i]);
+
+		if (S_ISDIR(st.st_mode))
+			dir_submit(&walk, path, dir_weight(path, 1));
+		else if (dir_add(&walk, path, 1, st.st_size))
+			free(path);
+	}
+
+	pool_free(&walk.pool);
+	pthread_mutex_destroy(&walk.lock);
+
+	if (walk.error) {
+		dir_files_free(walk.files, walk.length);
+		return walk.error;
+	}
+
+	qsort(walk.files, walk.length, sizeof(DirFile), dir_file_comparator);
+	*files = walk.files;
+	*length = walk.length;
+	return 0;
+}
+
+void dir_files_free(DirFile *files, size_t length)
+{
+	size_t i;
+	for (i = 0; i < length; ++i)
+		free(files[i].path);
+	free(files);
+}
+
+int dir_weight(const char *path, int inherited)
+{
+	char name[strlen(path) + sizeof(DIR_WEIGHT_FILE) + 1];
+	int weight;
+
+	sprintf(name, "%s/%s", path, DIR_WEIGHT_FILE);
+	FILE *file = fopen(name, "r");
+	if (file == NULL)
+		return inherited;
+	if (fscanf(file, "%d", &weight) != 1 || weight < 0)
+		weight = inherited;
+	fclose(file);
+	return weight;
+}
+
+int dir_submit(DirWalk *walk, char *path, int weight)
+{
+	/* A directory that weighs nothing is not listed at all. */
+	if (weight == 0) {
+		free(path);
+		return 0;
+	}
+
+	DirTask *task = malloc(sizeof(DirTask));
+	if (task == NULL) {
+		free(path);
+		return dir_fail(walk);
+	}
+	task->walk = walk;
+	task->path = path;
+	task->weight = weight;
+
+	if (pool_submit(&walk->pool, dir_task_run, task)) {
+		free(task);
+		free(path);
+		return dir_fail(walk);
+	}
+	return 0;
+}
+
+int dir_fail(DirWalk *walk)
+{
+	pthread_mutex_lock(&walk->lock);
+	walk->error = -1;
+	pthread_mutex_unlock(&walk->lock);
+	return -1;
+}
+
+int dir_add(DirWalk *walk, char *path, int weight, uint64_t size)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&walk->lock);
+	if (walk->length == walk->capacity) {
+		size_t capacity = walk->capacity ? walk->capacity * 2 : 256;
+		DirFile *files = realloc(walk->files, sizeof(DirFile) * capacity);
+		if (files == NULL) {
+			walk->error = ret = -1;
+		} else {
+			walk->files = files;
+			walk->capacity = capacity;
+		}
+	}
+	if (ret == 0) {
+		walk->files[walk->length].path = path;
+		walk->files[walk->length].weight = weight;
+		walk->files[walk->length].size = size;
+		++walk->length;
+	}
+	pthread_mutex_unlock(&walk->lock);
+
+	return ret;
+}
+
+void dir_task_run(void *arg)
+{
+	DirTask *task = arg;
+	DirWalk *walk = task->walk;
+	struct dirent *entry;
+	struct stat st;
+
+	DIR *dir = opendir(task->path);
+	if (dir == NULL)
+		dir_fail(walk);
+
+	while (dir && (entry = readdir(dir)) != NULL) {
+		if (dir_skip(entry->d_name))
+			continue;
+
+		char *path = malloc(strlen(task->path) + strlen(entry->d_name) + 2);
+		if (path == NULL) {
+			dir_fail(walk);
+			break;
+		}
+		sprintf(path, "%s/%s", task->path, entry->d_name);
+
+		/* Links are not followed into directories, so a loop cannot trap the
+		 * walk, but a link to a file counts as the file.
+		 */
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+			dir_submit(walk, path, dir_weight(path, task->weight));
+		else if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (dir_add(walk, path, task->weight, st.st_size))
+				free(path);
+		} else
+			free(path);
+	}
+
+	if (dir)
+		closedir(dir);
+	free(task->path);
+	free(task);
+}
+
+int dir_file_comparator(const void *x, const void *y)
+{
+	return strcmp(((const DirFile *) x)->path, ((const DirFile *) y)->path);
+}
+
+bool dir_skip(const char *name)
+{
+	size_t length = strlen(name);
+	size_t suffix = strlen(NORM_SUFFIX);
+	if (name[0] == '.')
+		return true;
+	return length > suffix && strcmp(name + length - suffix, NORM_SUFFIX) == 0;
+}
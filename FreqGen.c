@@ -0,0 +1,305 @@
+/*
+ * FreqGen.c
+ *
+ * Generates FreqScanners.c, which holds a specialized matcher for each of the
+ * FREQ_* patterns in FreqPatterns.h. Each pattern is parsed, compiled to a Pike
+ * VM program, and turned into a DFA by subset construction. The DFA is written
+ * out as straight-line C: one label per state and a switch on the byte's class,
+ * so nothing is compiled at run time and the C compiler sees the whole machine.
+ *
+ * A DFA finds the longest match from each start, which is the match that
+ * regexec() reports, but it cannot say where a subexpression inside the match
+ * begins. So a pattern is only generated if it has no subexpressions, or if its
+ * first subexpression is the whole pattern, as in FREQ_WORDS. The others, such
+ * as FREQ_FIRST_LETTER, are left to the other backends and engines.
+ *
+ * Usage: FreqGen > FreqScanners.c
+ */
+
+#include <ctype.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreqPatterns.h"
+#include "FreqRegex.c"
+#include "FreqBackend.c"
+
+#define GEN_MAX_STATES 1024
+
+typedef struct {
+	int nclasses;
+	uint8_t class_of[256]; /* class of each byte; class 0 is never matched */
+	uint8_t rep[256]; /* a byte from each class */
+
+	int nstates;
+	char *members[GEN_MAX_STATES]; /* members[s][pc] iff the NFA is at pc in state s */
+	bool accept[GEN_MAX_STATES];
+	int *next[GEN_MAX_STATES]; /* next[s][class], or -1 for no match */
+} GenDFA;
+
+/*
+ * Builds the DFA for the Pike VM program in (vm).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: The DFA has more than GEN_MAX_STATES states, or memory ran out.
+ */
+int gen_build(GenDFA *dfa, const PikeVM *vm);
+
+/*
+ * Adds (pc) and every instruction reachable from it without consuming a byte
+ * to (members). Returns true if a match is reachable.
+ */
+bool gen_closure(const PikeVM *vm, char *members, int pc);
+
+/*
+ * Returns the state whose members are (members), adding it to (dfa) if there is
+ * none yet. Returns -1 if there are too many states.
+ */
+int gen_state(GenDFA *dfa, const PikeVM *vm, char *members, bool accept);
+
+void gen_free(GenDFA *dfa);
+
+/*
+ * Writes the C code for the matcher of the pattern (name) to (stream).
+ */
+int gen_emit(FILE *stream, const GenDFA *dfa, const char *name, bool whole_capture);
+
+
+int main(void)
+{
+	size_t npatterns = sizeof(freq_patterns) / sizeof(freq_patterns[0]);
+	bool generated[sizeof(freq_patterns) / sizeof(freq_patterns[0])];
+	size_t p;
+
+	printf("/* \n * FreqScanners.c\n *\n * Generated by FreqGen from FreqPatterns.h. "
+			"Do not edit.\n *\n * In order to use this file you must include "
+			"FreqBackend.c and FreqPatterns.h.\n */\n");
+
+	for (p = 0; p < npatterns; ++p) {
+		const char *name = freq_patterns[p].name;
+		Regex re;
+		void *state;
+		GenDFA dfa;
+		generated[p] = false;
+
+		if (regex_parse(&re, freq_patterns[p].regex, true)) {
+			fprintf(stderr, "FreqGen: skipping %s: unsupported syntax\n", name);
+			continue;
+		}
+
+		bool whole_capture = re.nodes[re.root].type == REGEX_GROUP &&
+				re.nodes[re.root].group == 1;
+		if (re.ngroups > 0 && !whole_capture) {
+			fprintf(stderr, "FreqGen: skipping %s: the DFA cannot track its "
+					"subexpression\n", name);
+			continue;
+		}
+
+		if (pike_compile(&state, freq_patterns[p].regex)) {
+			fprintf(stderr, "FreqGen: skipping %s: too long\n", name);
+			continue;
+		}
+
+		int ret = gen_build(&dfa, state);
+		pike_free(state);
+		if (ret == 0) {
+			gen_emit(stdout, &dfa, name, whole_capture);
+			generated[p] = true;
+		} else {
+			fprintf(stderr, "FreqGen: skipping %s: too many states\n", name);
+		}
+		gen_free(&dfa);
+	}
+
+	printf("\nstatic const GenScanner gen_scanners[] = {\n");
+	for (p = 0; p < npatterns; ++p)
+		if (generated[p])
+			printf("\t{ %s, gen_%s_exec }, \n", freq_patterns[p].name,
+					freq_patterns[p].name);
+	printf("};\n");
+
+	return 0;
+}
+
+int gen_build(GenDFA *dfa, const PikeVM *vm)
+{
+	int c, k, s, pc;
+	memset(dfa, 0, sizeof(GenDFA));
+
+	/* Two bytes are in the same class iff every set in the program agrees on
+	 * them.
+	 */
+	for (c = 0; c < 256; ++c) {
+		bool any = false;
+		for (k = 0; k < vm->nsets; ++k)
+			any |= byteset_has(&vm->sets[k], c);
+		if (!any) continue;
+
+		for (k = 1; k <= dfa->nclasses; ++k) {
+			int j;
+			for (j = 0; j < vm->nsets; ++j)
+				if (byteset_has(&vm->sets[j], c) !=
+						byteset_has(&vm->sets[j], dfa->rep[k]))
+					break;
+			if (j == vm->nsets) break;
+		}
+		if (k > dfa->nclasses) {
+			dfa->nclasses = k;
+			dfa->rep[k] = c;
+		}
+		dfa->class_of[c] = k;
+	}
+
+	char *members = calloc(vm->length, 1);
+	if (members == NULL) return -1;
+	bool accept = gen_closure(vm, members, 0);
+	if (gen_state(dfa, vm, members, accept) < 0) return -1;
+
+	for (s = 0; s < dfa->nstates; ++s) {
+		for (k = 1; k <= dfa->nclasses; ++k) {
+			members = calloc(vm->length, 1);
+			if (members == NULL) return -1;
+
+			bool any = false;
+			accept = false;
+			for (pc = 0; pc < vm->length; ++pc) {
+				if (!dfa->members[s][pc]) continue;
+				if (!byteset_has(&vm->sets[vm->prog[pc].x], dfa->rep[k])) continue;
+				accept |= gen_closure(vm, members, pc + 1);
+				any = true;
+			}
+
+			if (any) {
+				if ((dfa->next[s][k] = gen_state(dfa, vm, members, accept)) < 0)
+					return -1;
+			} else {
+				free(members);
+			}
+		}
+	}
+
+	return 0;
+}
+
+bool gen_closure(const PikeVM *vm, char *members, int pc)
+{
+	const PikeInst *inst = &vm->prog[pc];
+	switch (inst->op) {
+	case PIKE_SET:
+		members[pc] = 1;
+		return false;
+	case PIKE_SPLIT:
+		if (members[pc]) return false;
+		members[pc] = 2; /* visited, but not a state of its own */
+		return gen_closure(vm, members, inst->x) | gen_closure(vm, members, inst->y);
+	case PIKE_JMP:
+		return gen_closure(vm, members, inst->x);
+	case PIKE_SAVE:
+		return gen_closure(vm, members, pc + 1);
+	default:
+		return true;
+	}
+}
+
+int gen_state(GenDFA *dfa, const PikeVM *vm, char *members, bool accept)
+{
+	int s, pc;
+
+	/* Only the bytes that consume input matter. */
+	for (pc = 0; pc < vm->length; ++pc)
+		if (members[pc] == 2)
+			members[pc] = 0;
+
+	for (s = 0; s < dfa->nstates; ++s) {
+		if (memcmp(dfa->members[s], members, vm->length) == 0) {
+			free(members);
+			return s;
+		}
+	}
+
+	if (dfa->nstates == GEN_MAX_STATES) {
+		free(members);
+		return -1;
+	}
+
+	s = dfa->nstates;
+	dfa->next[s] = malloc(sizeof(int) * 256);
+	if (dfa->next[s] == NULL) {
+		free(members);
+		return -1;
+	}
+	for (pc = 0; pc < 256; ++pc)
+		dfa->next[s][pc] = -1;
+	dfa->members[s] = members;
+	dfa->accept[s] = accept;
+	++dfa->nstates;
+	return s;
+}
+
+void gen_free(GenDFA *dfa)
+{
+	int s;
+	for (s = 0; s < dfa->nstates; ++s) {
+		free(dfa->members[s]);
+		free(dfa->next[s]);
+	}
+}
+
+int gen_emit(FILE *stream, const GenDFA *dfa, const char *name, bool whole_capture)
+{
+	int c, k, s;
+	bool target[GEN_MAX_STATES] = { false };
+
+	/* Only the states that are jumped to get a label; an unused one warns. */
+	for (s = 0; s < dfa->nstates; ++s)
+		for (k = 1; k <= dfa->nclasses; ++k)
+			if (dfa->next[s][k] >= 0)
+				target[dfa->next[s][k]] = true;
+
+	fprintf(stream, "\nstatic const unsigned char gen_%s_class[256] = {", name);
+	for (c = 0; c < 256; ++c)
+		fprintf(stream, "%s%d,", c % 16 ? " " : "\n\t", dfa->class_of[c]);
+	fprintf(stream, "\n};\n");
+
+	/* The longest match starting at (s), as a length, or -1. */
+	fprintf(stream, "\nstatic int gen_%s_longest(const unsigned char *s)\n{\n", name);
+	fprintf(stream, "\tconst unsigned char *p = s;\n\tint last = -1;\n");
+	for (s = 0; s < dfa->nstates; ++s) {
+		if (target[s])
+			fprintf(stream, "\ns%d:\n", s);
+		else
+			fprintf(stream, "\n");
+		if (dfa->accept[s])
+			fprintf(stream, "\tlast = p - s;\n");
+		fprintf(stream, "\tswitch (gen_%s_class[*p++]) {\n", name);
+		for (k = 1; k <= dfa->nclasses; ++k)
+			if (dfa->next[s][k] >= 0)
+				fprintf(stream, "\tcase %d: goto s%d;\n", k, dfa->next[s][k]);
+		fprintf(stream, "\tdefault: return last;\n\t}\n");
+	}
+	fprintf(stream, "}\n");
+
+	/* The leftmost match is the longest one from the first start that has one. */
+	fprintf(stream, "\nstatic int gen_%s_exec(const char *string, regmatch_t match[2])\n{\n",
+			name);
+	fprintf(stream, "\tregoff_t i;\n\tint length;\n");
+	fprintf(stream, "\tfor (i = 0; ; ++i) {\n");
+	fprintf(stream, "\t\tlength = gen_%s_longest((const unsigned char *) string + i);\n",
+			name);
+	fprintf(stream, "\t\tif (length >= 0) {\n");
+	fprintf(stream, "\t\t\tmatch[0].rm_so = i;\n\t\t\tmatch[0].rm_eo = i + length;\n");
+	if (whole_capture)
+		fprintf(stream, "\t\t\tmatch[1] = match[0];\n");
+	else
+		fprintf(stream, "\t\t\tmatch[1].rm_so = match[1].rm_eo = -1;\n");
+	fprintf(stream, "\t\t\treturn 0;\n\t\t}\n");
+	fprintf(stream, "\t\tif (string[i] == '\\0')\n\t\t\treturn REG_NOMATCH;\n");
+	fprintf(stream, "\t}\n}\n");
+
+	return 0;
+}
@@ -3,15 +3,23 @@
  * 
  * A hash table specially designed for counting letter frequency.
  * 
- * In order to use this hash table you must include stdio, stdlib and string.
+ * In order to use this hash table you must include stdbool, stdint, stdio, stdlib and 
+ * string.
  */
 
 #define DEFAULT_CAPACITY 10
 #define RESIZE_MIN 16
 
+/* hash_function() is djb2: x = 33*x + c for each (signed) char c, from 5381. */
+#define HASH_SEED 5381
+#define HASH_MULT 33
+#define HASH_BYTE(c) ((size_t) (signed char) (c))
+
 typedef struct {
 	char *key;
 	double value;
+	size_t hashval; /* hash_function(key), so that lookups rarely need strcmp */
+	uint64_t stamp; /* the last (stamp) that hash_inc_once() counted the key for */
 } Pair;
 
 typedef struct {
@@ -53,6 +61,13 @@ int hash_exists(Hash hash, char *key);
  */
 long hash_get(Hash hash, char *key);
 
+/* 
+ * Returns the pair of (key) in (hash), or NULL if there is none. (hashval) must 
+ * be equal to what hash_function() returns for the key, such as the hashval of 
+ * a pair from another hash.
+ */
+Pair * hash_find(Hash hash, const char *key, size_t hashval);
+
 /* 
  * This is a function that is particularly useful when counting letter frequency. It 
  * finds (key) in (hash) and increases it by (value). If (key) is not found, it is created 
@@ -60,6 +75,29 @@ long hash_get(Hash hash, char *key);
  */
 int hash_inc(Hash *hash, const char *key, double value);
 
+/* 
+ * Does the same thing as hash_inc(), but (key) is the first (length) bytes of a 
+ * string that need not be terminated, and its hash has already been computed. 
+ * (hashval) must be equal to what hash_function() returns for the key.
+ */
+int hash_inc_hashed(Hash *hash, const char *key, size_t length, size_t hashval, 
+		double value);
+
+/* 
+ * Does the same thing as hash_inc_hashed() with a (value) of 1, unless the key 
+ * has already been counted with the same (stamp), and then stamps the key. A 
+ * stamp that changes for each document thus counts the documents a key is in, 
+ * without a set of the keys of each document. New keys have a stamp of 0.
+ */
+int hash_inc_once(Hash *hash, const char *key, size_t length, size_t hashval, 
+		uint64_t stamp);
+
+/* 
+ * Takes (pair), which must be in (hash), out of it and frees its key. The 
+ * pairs after it in its bucket may move.
+ */
+void hash_remove(Hash *hash, Pair *pair);
+
 /* 
  * Prints (hash) to the output stream.
  */
@@ -76,11 +114,20 @@ long hash_put(Hash *hash, const char *key, double value);
 int hash_foreach(Hash hash, int (*f)(const char *key, double value));
 
 /* 
- * Sorts (hash) by value and puts the resulting array in (res).
+ * Adds the value of every pair in (src), times (scale), to (dest), as if by 
+ * hash_inc().
+ */
+int hash_merge(Hash *dest, Hash src, double scale);
+
+/* 
+ * Sorts (hash) by value, and keys of equal value by strcmp(), and puts the 
+ * resulting array in (res).
  * 
  * res: A pointer to an array, for the sorted hash to be placed in. This function will 
  *   allocate res, so do not pass in an already-allocated pointer.
  * length: The length of res. The function will set this value.
+ * 
+ * Returns -1 if out of memory.
  */
 int hash_sort(Pair **res, size_t *length, Hash hash);
 int pair_comparator(const void *x, const void *y);
@@ -88,6 +135,19 @@ int pair_comparator(const void *x, const void *y);
 int hash_test();
 
 size_t hash_function(const char *key);
+
+/* 
+ * Returns HASH_MULT to the power of (n). This is what makes hash_function() a 
+ * rolling hash: for a key of (n) bytes, 
+ *   hash_function(key) == HASH_SEED * hash_power(n) + 
+ *       HASH_BYTE(key[0]) * 33^(n-1) + ... + HASH_BYTE(key[n-1])
+ * so a scanner can keep the sum for a window of (n) bytes up to date as the 
+ * window slides, by adding the byte that enters and subtracting 
+ * HASH_BYTE(out) * hash_power(n) for the byte that leaves.
+ */
+size_t hash_power(size_t n);
+int hash_add(Hash *hash, const char *key, size_t length, size_t hashval, 
+		double value, bool increment);
 void * hash_malloc(size_t size);
 void * hash_realloc(void *ptr, size_t size);
 int hash_resize(Hash *hash);
@@ -126,12 +186,14 @@ int hash_clear(Hash *hash)
 
 int hash_exists(Hash hash, char *key)
 {	
-	size_t j, i = hash_function(key) % hash.length;
+	size_t hashval = hash_function(key);
+	size_t j, i = hashval % hash.length;
 	
 	if (hash.buckets[i].pairs) {		
 		// Find the key in the bucket.
 		for (j = 0; j < hash.buckets[i].length; ++j)
-			if (strcmp(hash.buckets[i].pairs[j].key, key) == 0)
+			if (hash.buckets[i].pairs[j].hashval == hashval && 
+					strcmp(hash.buckets[i].pairs[j].key, key) == 0)
 				return 1;
 	}
 	
@@ -141,12 +203,14 @@ int hash_exists(Hash hash, char *key)
 
 long hash_get(Hash hash, char *key)
 {
-	size_t j, i = hash_function(key) % hash.length;
+	size_t hashval = hash_function(key);
+	size_t j, i = hashval % hash.length;
 	
 	if (hash.buckets[i].pairs) {		
 		// Find the key in the bucket.
 		for (j = 0; j < hash.buckets[i].length; ++j)
-			if (strcmp(hash.buckets[i].pairs[j].key, key) == 0)
+			if (hash.buckets[i].pairs[j].hashval == hashval && 
+					strcmp(hash.buckets[i].pairs[j].key, key) == 0)
 				return hash.buckets[i].pairs[j].value;
 	}
 	
@@ -154,17 +218,93 @@ long hash_get(Hash hash, char *key)
 	return -1;
 }
 
+Pair * hash_find(Hash hash, const char *key, size_t hashval)
+{
+	size_t j, i = hashval % hash.length;
+	
+	for (j = 0; j < hash.buckets[i].length; ++j)
+		if (hash.buckets[i].pairs[j].hashval == hashval && 
+				strcmp(hash.buckets[i].pairs[j].key, key) == 0)
+			return &hash.buckets[i].pairs[j];
+	return NULL;
+}
+
 int hash_inc(Hash *hash, const char *key, double value)
 {
-	size_t j, i = hash_function(key) % hash->length;
+	return hash_add(hash, key, strlen(key), hash_function(key), value, true);
+}
+
+int hash_inc_hashed(Hash *hash, const char *key, size_t length, size_t hashval, 
+		double value)
+{
+	return hash_add(hash, key, length, hashval, value, true);
+}
+
+int hash_inc_once(Hash *hash, const char *key, size_t length, size_t hashval, 
+		uint64_t stamp)
+{
+	size_t j, i = hashval % hash->length;
+	Pair *pair;
+	
+	for (j = 0; j < hash->buckets[i].length; ++j) {
+		pair = &hash->buckets[i].pairs[j];
+		if (pair->hashval == hashval && strncmp(pair->key, key, length) == 0 && 
+				pair->key[length] == '\0') {
+			if (pair->stamp != stamp) {
+				pair->stamp = stamp;
+				pair->value += 1;
+			}
+			return 0;
+		}
+	}
+	
+	// The key is new. Adding it may resize the hash, so it is looked up again.
+	hash_add(hash, key, length, hashval, 1, true);
+	i = hashval % hash->length;
+	for (j = hash->buckets[i].length; j-- > 0; ) {
+		pair = &hash->buckets[i].pairs[j];
+		if (pair->hashval == hashval && strncmp(pair->key, key, length) == 0 && 
+				pair->key[length] == '\0') {
+			pair->stamp = stamp;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void hash_remove(Hash *hash, Pair *pair)
+{
+	Bucket *bucket = &hash->buckets[pair->hashval % hash->length];
+	
+	// The last pair of the bucket takes its place. The bucket keeps its room.
+	free(pair->key);
+	*pair = bucket->pairs[--bucket->length];
+	bucket->pairs[bucket->length].key = NULL;
+	--hash->count;
+}
+
+/* 
+ * Finds the first (length) bytes of (key) in (hash) and either increases its 
+ * value by (value) or sets it to (value). If the key is not found, it is created 
+ * and its value is set to (value).
+ */
+int hash_add(Hash *hash, const char *key, size_t length, size_t hashval, 
+		double value, bool increment)
+{
+	size_t j, i = hashval % hash->length;
+	Pair *pair;
 		
 	if (hash->buckets[i].pairs) {		
 		// Find the pair in the bucket.
-		for (j = 0; j < hash->buckets[i].length; ++j)
-			if (strcmp(hash->buckets[i].pairs[j].key, key) == 0) {
-				hash->buckets[i].pairs[j].value += value;
+		for (j = 0; j < hash->buckets[i].length; ++j) {
+			pair = &hash->buckets[i].pairs[j];
+			if (pair->hashval == hashval && strncmp(pair->key, key, length) == 0 && 
+					pair->key[length] == '\0') {
+				if (increment) pair->value += value;
+				else pair->value = value;
 				return 0;
 			}
+		}
 		
 		// The pair does not exist in the bucket.
 		
@@ -176,21 +316,21 @@ int hash_inc(Hash *hash, const char *key, double value)
 				hash->buckets[i].pairs[j].key = NULL;
 		}
 		
-		// Put the new pair at the end of the bucket.
-		hash->buckets[i].pairs[j].key = hash_malloc(strlen(key) + 1);
-		strcpy(hash->buckets[i].pairs[j].key, key);
-		hash->buckets[i].pairs[j].value = value;
-		++hash->buckets[i].length;
-		
 	} else {
 		// The bucket does not exist. Create a new bucket and put the pair in it.
 		hash->buckets[i].pairs = hash_malloc(sizeof(Pair) * next_size(1));
-		hash->buckets[i].length = 1;
-		hash->buckets[i].pairs[0].key = hash_malloc(strlen(key) + 1);
-		strcpy(hash->buckets[i].pairs[0].key, key);
-		hash->buckets[i].pairs[0].value = value;
+		hash->buckets[i].length = 0;
 	}
 	
+	// Put the new pair at the end of the bucket.
+	pair = &hash->buckets[i].pairs[hash->buckets[i].length];
+	pair->key = hash_malloc(length + 1);
+	memcpy(pair->key, key, length);
+	pair->value = value;
+	pair->hashval = hashval;
+	pair->stamp = 0;
+	++hash->buckets[i].length;
+	
 	++hash->count;
 	if (hash->count * 100 > hash->length * 75) {
 		hash_resize(hash);
@@ -199,12 +339,14 @@ int hash_inc(Hash *hash, const char *key, double value)
 	return 0;
 }
 
-int hash_merge(Hash *dest, Hash src)
+int hash_merge(Hash *dest, Hash src, double scale)
 {
 	size_t i, j;
 	for (i = 0; i < src.length; ++i)
 		for (j = 0; j < src.buckets[i].length; ++j)
-			hash_inc(dest, src.buckets[i].pairs[j].key, src.buckets[i].pairs[j].value);
+			hash_inc_hashed(dest, src.buckets[i].pairs[j].key, 
+					strlen(src.buckets[i].pairs[j].key), src.buckets[i].pairs[j].hashval, 
+					src.buckets[i].pairs[j].value * scale);
 	return 0;
 }
 
@@ -222,48 +364,7 @@ int hash_print(Hash hash)
 
 long hash_put(Hash *hash, const char *key, double value)
 {
-	size_t j, i = hash_function(key) % hash->length;
-	
-	if (hash->buckets[i].pairs) {		
-		// Find the pair in the bucket.
-		for (j = 0; j < hash->buckets[i].length; ++j)
-			if (strcmp(hash->buckets[i].pairs[j].key, key) == 0) {
-				hash->buckets[i].pairs[j].value = value;
-				return 0;
-			}
-		
-		// The pair does not exist in the bucket.
-		
-		// Resize the bucket if necessary.
-		if (resize_p(hash->buckets[i].length)) {
-			hash->buckets[i].pairs = hash_realloc(hash->buckets[i].pairs, 
-					sizeof(Pair) * next_size(hash->buckets[i].length + 1));
-			for (j = hash->buckets[i].length; j < next_size(hash->buckets[i].length + 1); ++j)
-				hash->buckets[i].pairs[j].key = NULL;
-		}
-		
-		// Put the new pair at the end of the bucket.
-		hash->buckets[i].pairs[j].key = hash_malloc(strlen(key) + 1);
-		strcpy(hash->buckets[i].pairs[j].key, key);
-		hash->buckets[i].pairs[j].value = value;
-		++hash->buckets[i].length;
-		
-	} else {
-		// The bucket does not exist. Create a new bucket and put the pair in it.
-		hash->buckets[i].pairs = hash_malloc(sizeof(Pair) * next_size(1));
-		hash->buckets[i].length = 1;
-		hash->buckets[i].pairs[0].key = hash_malloc(strlen(key) + 1);
-		strcpy(hash->buckets[i].pairs[0].key, key);
-		hash->buckets[i].pairs[0].value = value;
-	}
-	
-	++hash->count;
-	if (hash->count * 100 > hash->length * 75) {
-		hash_resize(hash);
-	}
-	
-	
-	return 0;
+	return hash_add(hash, key, strlen(key), hash_function(key), value, false);
 }
 
 int hash_foreach(Hash hash, int (*f)(const char *key, double value))
@@ -285,7 +386,11 @@ int hash_foreach(Hash hash, int (*f)(const char *key, double value))
 int hash_sort(Pair **res, size_t *length, Hash hash)
 {
 	*length = hash.count;
-	*res = malloc(sizeof(Bucket) * hash.count);
+	*res = malloc(sizeof(Pair) * hash.count);
+	if (*res == NULL && hash.count > 0) {
+		*length = 0;
+		return -1;
+	}
 	
 	size_t i, j, k = 0;
 	for (i = 0; i < hash.length; ++i) {
@@ -307,7 +412,7 @@ int pair_comparator(const void *x, const void *y)
 	
 	if (xp->value > yp->value) return -1;
 	else if (xp->value < yp->value) return 1;
-	else return 0;
+	else return strcmp(xp->key, yp->key);
 }
 
 int hash_test()
@@ -325,10 +430,19 @@ int hash_test()
 
 size_t hash_function(const char *key)
 {
-	size_t x = 5381;
+	size_t x = HASH_SEED;
 	--key;
 	while (*(++key))
-		x = 33*x + *key;
+		x = HASH_MULT*x + HASH_BYTE(*key);
+	
+	return x;
+}
+
+size_t hash_power(size_t n)
+{
+	size_t x = 1;
+	while (n--)
+		x *= HASH_MULT;
 	
 	return x;
 }
@@ -355,12 +469,19 @@ void * hash_realloc(void *ptr, size_t size)
 int hash_resize(Hash *hash)
 {
 	Hash res;
-	hash_init_capacity(&res, sizeof(Bucket) * next_size(hash->length));
+	hash_init_capacity(&res, next_size(hash->length));
 	size_t i, j;
 	for (i = 0; i < hash->length; ++i) {
 		for (j = 0; j < hash->buckets[i].length; ++j)
-			if (hash->buckets[i].pairs[j].key)
-				hash_put(&res, hash->buckets[i].pairs[j].key, hash->buckets[i].pairs[j].value);
+			if (hash->buckets[i].pairs[j].key) {
+				const Pair *pair = &hash->buckets[i].pairs[j];
+				hash_add(&res, pair->key, strlen(pair->key), pair->hashval, 
+						pair->value, false);
+				
+				// (res) is too big to resize here, so the pair is the last in its bucket.
+				Bucket *bucket = &res.buckets[pair->hashval % res.length];
+				bucket->pairs[bucket->length - 1].stamp = pair->stamp;
+			}
 	}
 	
 	hash_clear(hash);
@@ -0,0 +1,240 @@
+/*
+ * FreqNorm.c
+ *
+ * A cache of a text file after read_file() and filter_chars(), kept next to the
+ * file as FILENAME.norm, so that a scan can map it and start counting instead
+ * of reading and folding the text again. Besides the text, the cache holds a
+ * bitmap of the bytes that legal_chars() accepts and the offset of each line.
+ *
+ * A cache records the size and modification time of the file it was made from,
+ * and how the text was normalized. If any of those has changed, the cache is
+ * stale and is rebuilt.
+ *
+ * The layout is a NormHeader, then the text and a NUL, then the bitmap, then
+ * the line offsets, each starting on an 8-byte boundary. Numbers are in the
+ * machine's byte order.
+ *
+ * In order to use this file you must include fcntl.h, stdio, stdlib, sys/mman.h,
+ * sys/stat.h and unistd.h.
+ */
+
+#define NORM_MAGIC "FQNC"
+#define NORM_VERSION 2
+#define NORM_SUFFIX ".norm"
+
+/* Flags for how the text was normalized. */
+#define NORM_CASE_SENSITIVE 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t source_size;
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+	uint64_t length; /* bytes of text */
+	uint64_t nlines;
+	uint64_t text_offset, legal_offset, lines_offset;
+} NormHeader;
+
+typedef struct {
+	char *text; /* NUL-terminated and writable, though writes are not saved */
+	uint64_t length;
+	const uint64_t *legal; /* bit (i % 64) of legal[i / 64] iff text[i] is legal, or NULL */
+	const uint64_t *lines; /* offset of the start of each line, or NULL */
+	uint64_t nlines;
+
+	void *map; /* the mapped cache, or NULL if (text) was malloc'd */
+	size_t map_length;
+} NormText;
+
+
+/*
+ * Writes a cache of the normalized (text) of (length) bytes to (cache_file).
+ * (source) describes the file that the text came from. The cache is written to
+ * a temporary file first, so a reader never sees half of one.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File write error, or out of memory.
+ */
+int norm_write(const char *cache_file, const char *text, uint64_t length,
+		const struct stat *source, uint32_t flags);
+
+/*
+ * Maps the cache in (cache_file) into (norm), if it was made from the file that
+ * (source) describes with the same (flags).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: There is no cache, or it could not be read.
+ * -2: The cache is stale or malformed.
+ */
+int norm_open(NormText *norm, const char *cache_file, const struct stat *source,
+		uint32_t flags);
+
+/*
+ * Frees (norm), whether its text was mapped or malloc'd.
+ */
+void norm_close(NormText *norm);
+
+/*
+ * Returns the line that holds byte (offset) of (norm), counting from 0. (norm)
+ * must have a line index.
+ */
+uint64_t norm_line(const NormText *norm, uint64_t offset);
+
+uint64_t norm_align(uint64_t offset);
+
+
+uint64_t norm_align(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+int norm_write(const char *cache_file, const char *text, uint64_t length,
+		const struct stat *source, uint32_t flags)
+{
+	NormHeader header;
+	uint64_t i, nwords = (length + 63) / 64;
+
+	uint64_t *legal = calloc(nwords ? nwords : 1, sizeof(uint64_t));
+	if (legal == NULL) return -1;
+	for (i = 0; i < length; ++i) {
+		char c = text[i];
+		if (isprint(c) || c == '\n' || c == '\t')
+			legal[i / 64] |= (uint64_t) 1 << (i % 64);
+	}
+
+	memset(&header, 0, sizeof(NormHeader));
+	memcpy(header.magic, NORM_MAGIC, 4);
+	header.version = NORM_VERSION;
+	header.flags = flags;
+	header.source_size = source->st_size;
+	header.source_mtime_sec = source->st_mtim.tv_sec;
+	header.source_mtime_nsec = source->st_mtim.tv_nsec;
+	header.length = length;
+	header.nlines = 1;
+	for (i = 0; i < length; ++i)
+		if (text[i] == '\n' && i + 1 < length)
+			++header.nlines;
+	header.text_offset = norm_align(sizeof(NormHeader));
+	header.legal_offset = norm_align(header.text_offset + length + 1);
+	header.lines_offset = header.legal_offset + nwords * sizeof(uint64_t);
+
+	/* The temporary file has a name of its own, so that two jobs that write 
+	 * the cache of the same file at once do not write into each other's.
+	 */
+	size_t name_length = strlen(cache_file);
+	char *tmp_file = malloc(name_length + 8);
+	if (tmp_file == NULL) {
+		free(legal);
+		return -1;
+	}
+	memcpy(tmp_file, cache_file, name_length);
+	memcpy(tmp_file + name_length, ".XXXXXX", 8);
+
+	int fd = mkstemp(tmp_file);
+	FILE *fp = NULL;
+	if (fd >= 0) {
+		fp = fdopen(fd, "wb");
+		if (fp == NULL) close(fd);
+		else fchmod(fd, 0644);
+	}
+	int ret = fp ? 0 : -1;
+	static const char zeros[8];
+
+	if (ret == 0 && fwrite(&header, sizeof(NormHeader), 1, fp) != 1) ret = -1;
+	if (ret == 0 && fwrite(zeros, 1, header.text_offset - sizeof(NormHeader), fp) !=
+			header.text_offset - sizeof(NormHeader)) ret = -1;
+	if (ret == 0 && fwrite(text, 1, length, fp) != length) ret = -1;
+	if (ret == 0 && fwrite(zeros, 1, header.legal_offset - header.text_offset - length, fp) !=
+			header.legal_offset - header.text_offset - length) ret = -1;
+	if (ret == 0 && fwrite(legal, sizeof(uint64_t), nwords, fp) != nwords) ret = -1;
+
+	uint64_t line = 0;
+	if (ret == 0 && fwrite(&line, sizeof(uint64_t), 1, fp) != 1) ret = -1;
+	for (i = 0; i < length && ret == 0; ++i) {
+		if (text[i] == '\n' && i + 1 < length) {
+			line = i + 1;
+			if (fwrite(&line, sizeof(uint64_t), 1, fp) != 1) ret = -1;
+		}
+	}
+
+	if (fp && fclose(fp)) ret = -1;
+	if (ret == 0 && rename(tmp_file, cache_file)) ret = -1;
+	if (ret && fd >= 0) remove(tmp_file);
+
+	free(tmp_file);
+	free(legal);
+	return ret;
+}
+
+int norm_open(NormText *norm, const char *cache_file, const struct stat *source,
+		uint32_t flags)
+{
+	memset(norm, 0, sizeof(NormText));
+
+	int fd = open(cache_file, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(NormHeader)) {
+		close(fd);
+		return -2;
+	}
+
+	/* The text is mapped writable and private, because the scanners put NULs
+	 * into it for a moment; only the pages that they touch are copied.
+	 */
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	const NormHeader *header = map;
+	uint64_t nwords = (header->length + 63) / 64;
+	if (memcmp(header->magic, NORM_MAGIC, 4) || header->version != NORM_VERSION ||
+			header->flags != flags ||
+			header->source_size != (uint64_t) source->st_size ||
+			header->source_mtime_sec != source->st_mtim.tv_sec ||
+			header->source_mtime_nsec != source->st_mtim.tv_nsec ||
+			header->text_offset != norm_align(sizeof(NormHeader)) ||
+			header->legal_offset != norm_align(header->text_offset + header->length + 1) ||
+			header->lines_offset != header->legal_offset + nwords * sizeof(uint64_t) ||
+			header->lines_offset + header->nlines * sizeof(uint64_t) != (uint64_t) st.st_size) {
+		munmap(map, st.st_size);
+		return -2;
+	}
+
+	norm->map = map;
+	norm->map_length = st.st_size;
+	norm->text = (char *) map + header->text_offset;
+	norm->length = header->length;
+	norm->legal = (const uint64_t *) ((char *) map + header->legal_offset);
+	norm->lines = (const uint64_t *) ((char *) map + header->lines_offset);
+	norm->nlines = header->nlines;
+	return 0;
+}
+
+void norm_close(NormText *norm)
+{
+	if (norm->map)
+		munmap(norm->map, norm->map_length);
+	else
+		free(norm->text);
+	memset(norm, 0, sizeof(NormText));
+}
+
+uint64_t norm_line(const NormText *norm, uint64_t offset)
+{
+	uint64_t lo = 0, hi = norm->nlines;
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (norm->lines[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,69 @@
+/*
+ * FreqPatterns.h
+ *
+ * The patterns that frequency counts, and a table of them by name. FreqGen
+ * reads this file as well, so that it can generate a scanner for each pattern.
+ */
+
+#ifndef FREQ_PATTERNS_H
+#define FREQ_PATTERNS_H
+
+/* 
+ * REGEX CREATION TIPS
+ *
+ * If the regex contains a subexpression, this program will treat the first 
+ * subexpression as the target text. You can use this to e.g. match the 
+ * first letter in a word. The order of subexpressions is the order in which 
+ * they begin.
+ */
+
+#define FREQ_LETTER_CHARS "[a-z]"
+#define FREQ_LETTER_DIGRAPHS "[a-z]{2,2}"
+#define FREQ_LETTER_TRIGRAPHS "[a-z]{3,3}"
+#define FREQ_MAIN30_CHARS "[a-z.,;']"
+#define FREQ_MAIN30_DIGRAPHS "[a-z.,;']{2,2}"
+#define FREQ_MAIN30_TRIGRAPHS "[a-z.,;']{3,3}"
+#define FREQ_DIGRAPHS_NOSPC "[^\n\t ]{2,2}"
+#define FREQ_CHARS "."
+#define FREQ_DIGRAPHS ".."
+#define FREQ_TRIGRAPHS "..."
+
+// a word cannot have ' at beginning or end
+#define FREQ_WORDS "((([a-z])+('[a-z])?)+)"
+
+// BUG: Does not work for unknown reason.
+#define FREQ_NUMBERS "((\\+|-)?[0-9]+(\\.[0-9]+)?((e|E)[0-9]+)?)"
+
+#define FREQ_FIRST_LETTER "([a-z])[a-z]*"
+// BUG: these do not work because when the string fails to match, it is deleted
+#define FREQ_SECOND_LETTER "[a-z]([a-z])[a-z]*"
+#define FREQ_THIRD_LETTER "[a-z]{2,2}([a-z])[a-z]*"
+#define FREQ_LAST_LETTER "[a-z]*([a-z])"
+#define FREQ_FIRST_DIGRAPH "([a-z]{2,2})[a-z]*"
+#define FREQ_LAST_DIGRAPH "[a-z]*([a-z]{2,2})"
+
+static const struct {
+	const char *name;
+	const char *regex;
+} freq_patterns[] = {
+	{ "FREQ_LETTER_CHARS", FREQ_LETTER_CHARS }, 
+	{ "FREQ_LETTER_DIGRAPHS", FREQ_LETTER_DIGRAPHS }, 
+	{ "FREQ_LETTER_TRIGRAPHS", FREQ_LETTER_TRIGRAPHS }, 
+	{ "FREQ_MAIN30_CHARS", FREQ_MAIN30_CHARS }, 
+	{ "FREQ_MAIN30_DIGRAPHS", FREQ_MAIN30_DIGRAPHS }, 
+	{ "FREQ_MAIN30_TRIGRAPHS", FREQ_MAIN30_TRIGRAPHS }, 
+	{ "FREQ_DIGRAPHS_NOSPC", FREQ_DIGRAPHS_NOSPC }, 
+	{ "FREQ_CHARS", FREQ_CHARS }, 
+	{ "FREQ_DIGRAPHS", FREQ_DIGRAPHS }, 
+	{ "FREQ_TRIGRAPHS", FREQ_TRIGRAPHS }, 
+	{ "FREQ_WORDS", FREQ_WORDS }, 
+	{ "FREQ_NUMBERS", FREQ_NUMBERS }, 
+	{ "FREQ_FIRST_LETTER", FREQ_FIRST_LETTER }, 
+	{ "FREQ_SECOND_LETTER", FREQ_SECOND_LETTER }, 
+	{ "FREQ_THIRD_LETTER", FREQ_THIRD_LETTER }, 
+	{ "FREQ_LAST_LETTER", FREQ_LAST_LETTER }, 
+	{ "FREQ_FIRST_DIGRAPH", FREQ_FIRST_DIGRAPH }, 
+	{ "FREQ_LAST_DIGRAPH", FREQ_LAST_DIGRAPH }, 
+};
+
+#endif
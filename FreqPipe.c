@@ -0,0 +1,145 @@
+/*
+ * FreqPipe.c
+ *
+ * The parts of a staged pipeline: chunks of text that are passed from stage to
+ * stage, the queues between the stages, and a record of how busy each stage
+ * was. Each queue has one producer and one consumer, which lets it do without
+ * locks: only the producer moves (tail) and only the consumer moves (head). A
+ * stage that finds its queue full or empty spins for a moment and then yields,
+ * so a slow stage holds back the ones before it, and memory stays at the
+ * chunks that were made at the start.
+ *
+ * In order to use this file you must include sched.h, stdbool, stdint, stdio,
+ * stdlib and time.h.
+ */
+
+#define PIPE_CHUNK_SIZE (1 << 20)
+#define PIPE_CHUNKS 16
+#define PIPE_SPINS 64
+
+typedef struct {
+	char *data;
+	size_t length;
+	size_t file; /* the index of the file that the chunk is from */
+	bool first, last; /* the chunk is the first or last one of its file */
+	int error; /* -1 if the file could not be opened or read, otherwise 0 */
+} PipeChunk;
+
+typedef struct {
+	void **items;
+	size_t mask; /* the capacity, which is a power of 2, minus 1 */
+	size_t head; /* where the next item is popped from */
+	char pad[64]; /* keep (head) and (tail) on separate cache lines */
+	size_t tail; /* where the next item is pushed to */
+} PipeQueue;
+
+typedef struct {
+	const char *name;
+	uint64_t busy_ns; /* time spent working, not waiting on a queue */
+	uint64_t items;
+	uint64_t bytes;
+} PipeStats;
+
+
+/*
+ * Makes (queue) with room for (capacity) items, which must be a power of 2.
+ * Returns -1 if out of memory.
+ */
+int pipe_queue_init(PipeQueue *queue, size_t capacity);
+
+void pipe_queue_free(PipeQueue *queue);
+
+/*
+ * Adds (item) to the end of (queue), waiting while it is full. Only one
+ * thread may push to a queue.
+ */
+void pipe_push(PipeQueue *queue, void *item);
+
+/*
+ * Removes the item at the front of (queue) and returns it, waiting while the
+ * queue is empty. Only one thread may pop from a queue.
+ */
+void * pipe_pop(PipeQueue *queue);
+
+/*
+ * Returns the time in nanoseconds, from an arbitrary start.
+ */
+uint64_t pipe_clock(void);
+
+/*
+ * Prints how busy each of the (nstages) stages in (stats) was over (wall_ns)
+ * nanoseconds. A stage that is busy nearly all of the time is the one that
+ * limits the pipeline.
+ */
+void pipe_report(FILE *stream, const PipeStats *stats, size_t nstages, uint64_t wall_ns);
+
+void pipe_wait(int *spins);
+
+
+int pipe_queue_init(PipeQueue *queue, size_t capacity)
+{
+	queue->items = malloc(sizeof(void *) * capacity);
+	if (queue->items == NULL) return -1;
+	queue->mask = capacity - 1;
+	queue->head = queue->tail = 0;
+	return 0;
+}
+
+void pipe_queue_free(PipeQueue *queue)
+{
+	free(queue->items);
+	queue->items = NULL;
+}
+
+void pipe_wait(int *spins)
+{
+	if (++*spins >= PIPE_SPINS) {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+void pipe_push(PipeQueue *queue, void *item)
+{
+	size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	int spins = 0;
+
+	while (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) > queue->mask)
+		pipe_wait(&spins);
+
+	queue->items[tail & queue->mask] = item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void * pipe_pop(PipeQueue *queue)
+{
+	size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	int spins = 0;
+
+	while (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+		pipe_wait(&spins);
+
+	void *item = queue->items[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return item;
+}
+
+uint64_t pipe_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void pipe_report(FILE *stream, const PipeStats *stats, size_t nstages, uint64_t wall_ns)
+{
+	size_t i;
+	fprintf(stream, "%-12s%8s%10s%12s\n", "stage", "busy", "chunks", "MB/s busy");
+	for (i = 0; i < nstages; ++i) {
+		fprintf(stream, "%-12s%7.1f%%%10llu%12.1f\n", stats[i].name,
+				wall_ns ? 100.0 * stats[i].busy_ns / wall_ns : 0.0,
+				(unsigned long long) stats[i].items,
+				stats[i].busy_ns ? stats[i].bytes * 1e3 / stats[i].busy_ns : 0.0);
+	}
+	fprintf(stream, "wall        %7.1f ms\n", wall_ns / 1e6);
+}
@@ -0,0 +1,240 @@
+/*
+ * FreqPlan.c
+ *
+ * Decides how to scan for a pattern. The pattern is parsed and sorted into one
+ * of a few kinds, and each kind goes to the fastest engine that gives the same
+ * matches as the regexec() loop in freq_scan():
+ *
+ * - A fixed-length class n-gram such as "[a-z]{3,3}" needs no regex at all. The
+ *   class kernel finds every start from 64-byte bitmasks and counts them in a
+ *   DenseTable when the class is small enough, or in the hash otherwise.
+ * - A positional pattern such as "[a-z]{2,2}([a-z])[a-z]*" matches whole runs
+ *   of one class, so it is found by searching for the ends of runs.
+ * - Anything else goes to a regex backend, after skipping the bytes that cannot
+ *   begin a match whenever those are known. The Pike VM is used whenever it can
+ *   compile the pattern, since it runs several times faster than regexec() on
+ *   every FREQ_* pattern; see frequency --bench. A scanner generated by FreqGen
+ *   is faster still, when there is one.
+ *
+ * In order to use this file you must include FreqBackend.c, FreqClass.c,
+ * FreqDense.c and FreqRegex.c.
+ */
+
+enum {
+	PLAN_CLASS_NGRAM,
+	PLAN_POSITIONAL,
+	PLAN_LITERAL_SET,
+	PLAN_WORD,
+	PLAN_GENERAL,
+};
+
+enum {
+	ENGINE_CLASS_DENSE, /* class kernel counting in a DenseTable */
+	ENGINE_CLASS_HASH, /* class kernel counting in the hash */
+	ENGINE_CLASS_RUNS, /* byte-at-a-time class scan, for n > 64 */
+	ENGINE_RUNS, /* search for runs of the class */
+	ENGINE_REGEXEC_PREFILTER, /* plan->backend after skipping to a possible first byte */
+	ENGINE_REGEXEC, /* plan->backend at every position */
+};
+
+typedef struct {
+	int kind;
+	int engine;
+	bool overlap; /* whether matches may overlap, which they do iff the length is bounded */
+	ByteSet set; /* the class, for class n-grams and positional patterns */
+	int n; /* length of a class n-gram */
+	int min_length, offset, length; /* see regex_positional() */
+	bool from_end;
+	ByteSet first; /* bytes that can begin a match, for ENGINE_REGEXEC_PREFILTER */
+	const RegexBackend *backend; /* the matcher that the regexec engines use */
+	double density; /* estimated matches per byte of text */
+	double cost; /* estimated cycles per byte of text */
+} Plan;
+
+
+/*
+ * Parses (regex) and fills in (plan). This never fails: a pattern that the
+ * parser does not understand is planned for ENGINE_REGEXEC with the posix
+ * backend, and regcomp() decides whether it is valid.
+ */
+int plan_pattern(Plan *plan, const char *regex);
+
+/*
+ * Prints the plan for (regex) to (stream): its kind, the engine that will scan
+ * for it, and the estimated cost.
+ */
+int plan_explain(FILE *stream, const char *regex);
+
+double plan_text_fraction(const ByteSet *set);
+const char *plan_kind_name(int kind);
+const char *plan_engine_name(int engine);
+
+
+/*
+ * The cost model, in rough cycles. Every engine pays something for each byte of
+ * text and something for each match; a regex backend also pays for each
+ * position it is started at.
+ */
+#define COST_HASH_INC 40.0
+#define COST_DENSE_INC 3.0
+#define COST_REGEXEC 300.0
+#define COST_PIKE 60.0
+#define COST_GENERATED 15.0
+
+int plan_pattern(Plan *plan, const char *regex)
+{
+	Regex parsed;
+	int k;
+	memset(plan, 0, sizeof(Plan));
+	plan->backend = &posix_backend;
+
+	if (regex_parse(&parsed, regex, true)) {
+		/* Without a parse, fall back to the old guess at whether the length is
+		 * fixed.
+		 */
+		plan->kind = PLAN_GENERAL;
+		plan->engine = ENGINE_REGEXEC;
+		plan->overlap = !strchr(regex, '+') && !strchr(regex, '*');
+		plan->density = 1;
+		plan->cost = COST_REGEXEC;
+		return 0;
+	}
+
+	void *state;
+	double exec_cost = COST_REGEXEC;
+	if (pike_compile(&state, regex) == 0) {
+		pike_free(state);
+		plan->backend = &pike_backend;
+		exec_cost = COST_PIKE;
+	}
+#ifdef FREQ_HAVE_SCANNERS
+	if (generated_compile(&state, regex) == 0) {
+		plan->backend = &generated_backend;
+		exec_cost = COST_GENERATED;
+	}
+#endif
+
+	plan->overlap = regex_bounded(&parsed);
+	bool has_first = regex_first_bytes(&parsed, &plan->first);
+	double p = has_first ? plan_text_fraction(&plan->first) : 1;
+
+	if (plan->overlap && regex_class_ngram(&parsed, &plan->set, &plan->n)) {
+		DenseTable dense;
+		plan->kind = PLAN_CLASS_NGRAM;
+		p = plan_text_fraction(&plan->set);
+		plan->density = 1;
+		for (k = 0; k < plan->n; ++k)
+			plan->density *= p;
+		if (plan->n > 64) {
+			plan->engine = ENGINE_CLASS_RUNS;
+			plan->cost = 4 + plan->density * COST_HASH_INC;
+		} else if (dense_init(&dense, &plan->set, plan->n) == 0) {
+			free(dense.cells);
+			plan->engine = ENGINE_CLASS_DENSE;
+			plan->cost = 0.5 + plan->density * COST_DENSE_INC;
+		} else {
+			plan->engine = ENGINE_CLASS_HASH;
+			plan->cost = 0.5 + plan->density * COST_HASH_INC;
+		}
+		return 0;
+	}
+
+	if (!plan->overlap && regex_positional(&parsed, &plan->set, &plan->min_length,
+			&plan->offset, &plan->length, &plan->from_end)) {
+		plan->kind = PLAN_POSITIONAL;
+		plan->engine = ENGINE_RUNS;
+		p = plan_text_fraction(&plan->set);
+		plan->density = p * (1 - p);
+		plan->cost = 1 + plan->density * COST_HASH_INC;
+		return 0;
+	}
+
+	if (regex_literal_set(&parsed))
+		plan->kind = PLAN_LITERAL_SET;
+	else if (!plan->overlap && has_first)
+		plan->kind = PLAN_WORD;
+	else
+		plan->kind = PLAN_GENERAL;
+
+	plan->density = p;
+	if (has_first) {
+		plan->engine = ENGINE_REGEXEC_PREFILTER;
+		plan->cost = 0.5 + p * (exec_cost + COST_HASH_INC);
+	} else {
+		plan->engine = ENGINE_REGEXEC;
+		plan->cost = exec_cost + COST_HASH_INC;
+	}
+	return 0;
+}
+
+/*
+ * Estimates the fraction of the bytes in ordinary lowercase text that are in
+ * (set), treating the 95 printable characters, tab and newline as equally
+ * likely. The text has been through filter_chars(), so uppercase letters only
+ * count when their lowercase forms do not.
+ */
+double plan_text_fraction(const ByteSet *set)
+{
+	int c, members = 0;
+	for (c = 0; c < 128; ++c) {
+		if (!isprint(c) && c != '\n' && c != '\t')
+			continue;
+		if (isupper(c) && byteset_has(set, tolower(c)))
+			continue;
+		if (byteset_has(set, c))
+			++members;
+	}
+
+	/* There are 97 legal characters, and 26 of them only show up lowercase. */
+	return members / 71.0 < 1 ? members / 71.0 : 1;
+}
+
+const char *plan_kind_name(int kind)
+{
+	switch (kind) {
+	case PLAN_CLASS_NGRAM: return "fixed-length class n-gram";
+	case PLAN_POSITIONAL: return "capture-group positional pattern";
+	case PLAN_LITERAL_SET: return "literal set";
+	case PLAN_WORD: return "bounded word pattern";
+	default: return "general regex";
+	}
+}
+
+const char *plan_engine_name(int engine)
+{
+	switch (engine) {
+	case ENGINE_CLASS_DENSE: return "SIMD class kernel, dense counter";
+	case ENGINE_CLASS_HASH: return "SIMD class kernel, rolling hash";
+	case ENGINE_CLASS_RUNS: return "byte-at-a-time class scan, rolling hash";
+	case ENGINE_RUNS: return "class run search";
+	case ENGINE_REGEXEC_PREFILTER: return "regex backend with first-byte prefilter";
+	default: return "regex backend";
+	}
+}
+
+int plan_explain(FILE *stream, const char *regex)
+{
+	Plan plan;
+	plan_pattern(&plan, regex);
+
+	fprintf(stream, "pattern:  ");
+	for (; *regex; ++regex) {
+		if (*regex == '\n') fprintf(stream, "\\n");
+		else if (*regex == '\t') fprintf(stream, "\\t");
+		else fputc(*regex, stream);
+	}
+	fprintf(stream, "\nkind:     %s", plan_kind_name(plan.kind));
+	if (plan.kind == PLAN_CLASS_NGRAM)
+		fprintf(stream, " (n = %d)", plan.n);
+	else if (plan.kind == PLAN_POSITIONAL)
+		fprintf(stream, " (%d bytes, %d from the %s)", plan.length, plan.offset,
+				plan.from_end ? "end" : "start");
+	fprintf(stream, "\nengine:   %s", plan_engine_name(plan.engine));
+	if (plan.engine == ENGINE_REGEXEC_PREFILTER || plan.engine == ENGINE_REGEXEC)
+		fprintf(stream, " (%s)", plan.backend->name);
+	fprintf(stream, "\n");
+	fprintf(stream, "overlap:  %s\n", plan.overlap ? "yes" : "no");
+	fprintf(stream, "cost:     ~%.1f cycles/byte at ~%.3f matches/byte (estimated)\n",
+			plan.cost, plan.density);
+	return 0;
+}
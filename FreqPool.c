@@ -0,0 +1,156 @@
+/*
+ * FreqPool.c
+ *
+ * A fixed pool of threads that run tasks from a shared queue, in the order they
+ * were submitted. The pool knows nothing about what the tasks do; two tasks
+ * that share data must not be in the queue at the same time unless the data is
+ * safe to share.
+ *
+ * In order to use this file you must include pthread.h, stdbool and stdlib.
+ */
+
+typedef struct FreqTask {
+	void (*run)(void *arg);
+	void *arg;
+	struct FreqTask *next;
+} FreqTask;
+
+typedef struct {
+	pthread_t *threads;
+	int nthreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t ready; /* signaled when a task is queued or the pool stops */
+	pthread_cond_t idle; /* signaled when the last pending task finishes */
+	FreqTask *head, *tail;
+	size_t pending; /* tasks queued or running */
+	bool stopping;
+} FreqPool;
+
+
+/*
+ * Starts (nthreads) threads in (pool).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: A thread could not be started, or out of memory.
+ */
+int pool_init(FreqPool *pool, int nthreads);
+
+/*
+ * Queues a call to (run) with (arg). Returns -1 if out of memory.
+ */
+int pool_submit(FreqPool *pool, void (*run)(void *arg), void *arg);
+
+/*
+ * Waits until every task that has been submitted has finished.
+ */
+void pool_wait(FreqPool *pool);
+
+/*
+ * Waits for the queued tasks, then stops the threads and frees (pool).
+ */
+void pool_free(FreqPool *pool);
+
+void * pool_worker(void *arg);
+
+
+int pool_init(FreqPool *pool, int nthreads)
+{
+	pool->nthreads = 0;
+	pool->head = pool->tail = NULL;
+	pool->pending = 0;
+	pool->stopping = false;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	pool->threads = malloc(sizeof(pthread_t) * nthreads);
+	if (pool->threads == NULL) {
+		pool_free(pool);
+		return -1;
+	}
+
+	for (; pool->nthreads < nthreads; ++pool->nthreads) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL, pool_worker, pool)) {
+			pool_free(pool);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int pool_submit(FreqPool *pool, void (*run)(void *arg), void *arg)
+{
+	FreqTask *task = malloc(sizeof(FreqTask));
+	if (task == NULL) return -1;
+	task->run = run;
+	task->arg = arg;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail) pool->tail->next = task;
+	else pool->head = task;
+	pool->tail = task;
+	++pool->pending;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void pool_wait(FreqPool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(FreqPool *pool)
+{
+	int i;
+	pool_wait(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->ready);
+	pthread_cond_destroy(&pool->idle);
+}
+
+void * pool_worker(void *arg)
+{
+	FreqPool *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->head == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->ready, &pool->lock);
+		if (pool->head == NULL)
+			break;
+
+		FreqTask *task = pool->head;
+		pool->head = task->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+
+		pthread_mutex_unlock(&pool->lock);
+		task->run(task->arg);
+		free(task);
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
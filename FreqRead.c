@@ -0,0 +1,525 @@
+/*
+ * FreqRead.c
+ *
+ * Reads a list of files ahead of the scanner, so that the disk and the scan are
+ * busy at the same time. The files are cut into blocks of READ_BLOCK_SIZE
+ * bytes, which come back from readahead_next() in order, file after file, while
+ * the reads for up to READ_DEPTH blocks after them are in flight. A block is
+ * handed back with readahead_release() once it has been scanned, and its
+ * buffer is used for a later read.
+ *
+ * There are two ways to do the reads:
+ * - io_uring, if FREQ_HAVE_IO_URING is defined at build time and the kernel
+ *   allows it. All of the reads are queued at once and finish in any order.
+ * - pread() on a thread of its own, which reads one block after another.
+ *
+ * Only regular files can be read ahead, since the size of each file must be
+ * known before it is read. Any other file, such as a pipe or a terminal, comes
+ * back as one empty block with its descriptor in (stream_fd), for the caller
+ * to read to its end.
+ *
+ * In order to use this file you must include errno.h, fcntl.h, pthread.h,
+ * stdbool, stdint, stdlib, string.h, sys/stat.h and unistd.h.
+ */
+
+#ifdef FREQ_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define READ_BLOCK_SIZE (1 << 20)
+#define READ_DEPTH 8
+
+typedef struct {
+	char *data;
+	size_t length;
+	size_t file; /* the index of the file that the block is from */
+	bool first, last; /* the block is the first or last one of its file */
+	int error; /* -1 if the file could not be opened or read, otherwise 0 */
+	int stream_fd; /* the file to read as a stream if it is not regular, or -1 */
+} ReadBlock;
+
+typedef enum {
+	SLOT_FREE, SLOT_READING, SLOT_READY, SLOT_IN_USE
+} SlotState;
+
+typedef struct {
+	ReadBlock block;
+	SlotState state;
+	int fd;
+	uint64_t offset;
+	size_t wanted; /* bytes asked for; a read may come back with fewer */
+} ReadSlot;
+
+#ifdef FREQ_HAVE_IO_URING
+typedef struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_map_size, cq_map_size, sqes_size;
+} ReadRing;
+#endif
+
+typedef struct {
+	size_t nfiles;
+	int *fds; /* -1 for a file that could not be opened */
+	uint64_t *sizes;
+	bool *streams; /* the file is not a regular file and is not read ahead */
+
+	ReadSlot slots[READ_DEPTH];
+	size_t issued; /* blocks whose reads have been started */
+	size_t consumed; /* blocks that readahead_next() has returned */
+	size_t issue_file; /* where the next read starts */
+	uint64_t issue_offset;
+
+	bool uring;
+#ifdef FREQ_HAVE_IO_URING
+	ReadRing ring;
+#endif
+	bool failed; /* the reads stopped on an error, and no more blocks come */
+
+	/* For the pread() thread. */
+	pthread_t thread;
+	bool thread_started;
+	bool stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} ReadAhead;
+
+
+/*
+ * Opens the (nfiles) files in (filenames) in (ra) and starts reading them.
+ * (ra) must be freed with readahead_free().
+ *
+ * Return Codes
+ * -0: Success. A file that cannot be opened is not an error here; its block
+ *   comes back with an error instead.
+ * -1: Out of memory, or the reads could not be started.
+ */
+int readahead_init(ReadAhead *ra, const char **filenames, size_t nfiles);
+
+/*
+ * Waits for the next block and returns it, or returns NULL if there are no
+ * more, or if the reads failed, in which case (ra)->failed is set. Every file
+ * has at least one block, even if it is empty.
+ */
+ReadBlock * readahead_next(ReadAhead *ra);
+
+/*
+ * Gives (block) back to (ra) so that its buffer can be read into again.
+ */
+void readahead_release(ReadAhead *ra, ReadBlock *block);
+
+void readahead_free(ReadAhead *ra);
+
+/*
+ * Returns the name of the way that (ra) reads, "io_uring" or "pread".
+ */
+const char * readahead_method(const ReadAhead *ra);
+
+bool readahead_take(ReadAhead *ra, ReadSlot **slot);
+void * readahead_worker(void *arg);
+
+#ifdef FREQ_HAVE_IO_URING
+int ring_init(ReadRing *ring, unsigned entries);
+void ring_free(ReadRing *ring);
+int ring_submit(ReadRing *ring, ReadSlot *slot, unsigned long long user_data);
+int ring_fill(ReadAhead *ra);
+int ring_wait(ReadAhead *ra);
+#endif
+
+
+int readahead_init(ReadAhead *ra, const char **filenames, size_t nfiles)
+{
+	size_t i;
+	struct stat st;
+
+	memset(ra, 0, sizeof(ReadAhead));
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->changed, NULL);
+	ra->nfiles = nfiles;
+	ra->fds = malloc(sizeof(int) * (nfiles ? nfiles : 1));
+	ra->sizes = malloc(sizeof(uint64_t) * (nfiles ? nfiles : 1));
+	ra->streams = malloc(sizeof(bool) * (nfiles ? nfiles : 1));
+	if (ra->fds == NULL || ra->sizes == NULL || ra->streams == NULL) {
+		ra->nfiles = 0;
+		readahead_free(ra);
+		return -1;
+	}
+
+	for (i = 0; i < nfiles; ++i) {
+		ra->fds[i] = open(filenames[i], O_RDONLY);
+		ra->sizes[i] = 0;
+		ra->streams[i] = false;
+		if (ra->fds[i] >= 0 && fstat(ra->fds[i], &st) == 0) {
+			if (S_ISREG(st.st_mode))
+				ra->sizes[i] = st.st_size;
+			else
+				ra->streams[i] = true;
+		}
+#ifdef POSIX_FADV_SEQUENTIAL
+		if (ra->fds[i] >= 0)
+			posix_fadvise(ra->fds[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	for (i = 0; i < READ_DEPTH; ++i) {
+		ra->slots[i].block.data = malloc(READ_BLOCK_SIZE);
+		ra->slots[i].state = SLOT_FREE;
+		if (ra->slots[i].block.data == NULL) {
+			readahead_free(ra);
+			return -1;
+		}
+	}
+
+#ifdef FREQ_HAVE_IO_URING
+	if (ring_init(&ra->ring, READ_DEPTH) == 0) {
+		ra->uring = true;
+		if (ring_fill(ra) == 0)
+			return 0;
+		readahead_free(ra);
+		return -1;
+	}
+#endif
+
+	if (pthread_create(&ra->thread, NULL, readahead_worker, ra)) {
+		readahead_free(ra);
+		return -1;
+	}
+	ra->thread_started = true;
+	return 0;
+}
+
+/*
+ * Claims the slot for the next block that has not been started and fills in
+ * where it is, if there is such a block and its slot is free. Must be called
+ * with (ra->lock) held or with no thread running.
+ */
+bool readahead_take(ReadAhead *ra, ReadSlot **slot)
+{
+	if (ra->issue_file >= ra->nfiles)
+		return false;
+
+	ReadSlot *s = &ra->slots[ra->issued % READ_DEPTH];
+	if (s->state != SLOT_FREE)
+		return false;
+
+	size_t file = ra->issue_file;
+	uint64_t size = ra->sizes[file];
+	s->fd = ra->fds[file];
+	s->offset = ra->issue_offset;
+	s->wanted = size - s->offset < READ_BLOCK_SIZE ? size - s->offset : READ_BLOCK_SIZE;
+	s->block.file = file;
+	s->block.length = 0;
+	s->block.first = s->offset == 0;
+	s->block.last = s->offset + s->wanted >= size;
+	s->block.error = s->fd < 0 ? -1 : 0;
+	s->block.stream_fd = ra->streams[file] ? s->fd : -1;
+	s->state = SLOT_READING;
+
+	if (s->block.last) {
+		++ra->issue_file;
+		ra->issue_offset = 0;
+	} else {
+		ra->issue_offset += s->wanted;
+	}
+	++ra->issued;
+
+	*slot = s;
+	return true;
+}
+
+void * readahead_worker(void *arg)
+{
+	ReadAhead *ra = arg;
+	ReadSlot *slot;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		while (!ra->stopping && !readahead_take(ra, &slot)) {
+			if (ra->issue_file >= ra->nfiles) {
+				pthread_mutex_unlock(&ra->lock);
+				return NULL;
+			}
+			pthread_cond_wait(&ra->changed, &ra->lock);
+		}
+		if (ra->stopping)
+			break;
+		pthread_mutex_unlock(&ra->lock);
+
+		while (slot->block.error == 0 && slot->block.length < slot->wanted) {
+			ssize_t got = pread(slot->fd, slot->block.data + slot->block.length,
+					slot->wanted - slot->block.length, slot->offset + slot->block.length);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got < 0)
+				slot->block.error = -1;
+			if (got <= 0)
+				break;
+			slot->block.length += got;
+		}
+
+		pthread_mutex_lock(&ra->lock);
+		slot->state = SLOT_READY;
+		pthread_cond_broadcast(&ra->changed);
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+ReadBlock * readahead_next(ReadAhead *ra)
+{
+	pthread_mutex_lock(&ra->lock);
+	bool done = ra->consumed == ra->issued && ra->issue_file >= ra->nfiles;
+	pthread_mutex_unlock(&ra->lock);
+	if (done)
+		return NULL;
+
+	ReadSlot *slot = &ra->slots[ra->consumed % READ_DEPTH];
+
+#ifdef FREQ_HAVE_IO_URING
+	if (ra->uring) {
+		while (slot->state != SLOT_READY) {
+			if (ring_wait(ra)) {
+				ra->failed = true;
+				return NULL;
+			}
+		}
+		slot->state = SLOT_IN_USE;
+		++ra->consumed;
+		return &slot->block;
+	}
+#endif
+
+	pthread_mutex_lock(&ra->lock);
+	while (slot->state != SLOT_READY)
+		pthread_cond_wait(&ra->changed, &ra->lock);
+	slot->state = SLOT_IN_USE;
+	++ra->consumed;
+	pthread_mutex_unlock(&ra->lock);
+	return &slot->block;
+}
+
+void readahead_release(ReadAhead *ra, ReadBlock *block)
+{
+	ReadSlot *slot = (ReadSlot *) block;
+
+	pthread_mutex_lock(&ra->lock);
+	slot->state = SLOT_FREE;
+	pthread_cond_broadcast(&ra->changed);
+	pthread_mutex_unlock(&ra->lock);
+
+#ifdef FREQ_HAVE_IO_URING
+	if (ra->uring)
+		ring_fill(ra);
+#endif
+}
+
+void readahead_free(ReadAhead *ra)
+{
+	size_t i;
+
+	if (ra->thread_started) {
+		pthread_mutex_lock(&ra->lock);
+		ra->stopping = true;
+		pthread_cond_broadcast(&ra->changed);
+		pthread_mutex_unlock(&ra->lock);
+		pthread_join(ra->thread, NULL);
+		ra->thread_started = false;
+	}
+
+#ifdef FREQ_HAVE_IO_URING
+	/* Wait for the reads in flight, since they write into the buffers. */
+	if (ra->uring) {
+		for (i = 0; i < READ_DEPTH; ++i)
+			while (ra->slots[i].state == SLOT_READING)
+				if (ring_wait(ra))
+					break;
+		ring_free(&ra->ring);
+		ra->uring = false;
+	}
+#endif
+
+	pthread_mutex_destroy(&ra->lock);
+	pthread_cond_destroy(&ra->changed);
+
+	for (i = 0; i < READ_DEPTH; ++i) {
+		free(ra->slots[i].block.data);
+		ra->slots[i].block.data = NULL;
+	}
+	for (i = 0; i < ra->nfiles; ++i)
+		if (ra->fds[i] >= 0)
+			close(ra->fds[i]);
+	free(ra->fds);
+	free(ra->sizes);
+	free(ra->streams);
+	ra->fds = NULL;
+	ra->sizes = NULL;
+	ra->streams = NULL;
+	ra->nfiles = 0;
+}
+
+const char * readahead_method(const ReadAhead *ra)
+{
+	return ra->uring ? "io_uring" : "pread";
+}
+
+#ifdef FREQ_HAVE_IO_URING
+
+/*
+ * Sets up an io_uring with room for (entries) reads at a time. Returns -1 if
+ * the kernel does not support io_uring or will not let this process use it.
+ */
+int ring_init(ReadRing *ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(ReadRing));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		close(ring->fd);
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			munmap(ring->sq_map, ring->sq_map_size);
+			close(ring->fd);
+			return -1;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_map != ring->sq_map)
+			munmap(ring->cq_map, ring->cq_map_size);
+		munmap(ring->sq_map, ring->sq_map_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	char *sq = ring->sq_map, *cq = ring->cq_map;
+	ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	return 0;
+}
+
+void ring_free(ReadRing *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->fd);
+}
+
+/*
+ * Queues a read of the rest of (slot)'s block and submits it.
+ */
+int ring_submit(ReadRing *ring, ReadSlot *slot, unsigned long long user_data)
+{
+	unsigned tail = *ring->sq_tail, index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = slot->fd;
+	sqe->addr = (unsigned long long) (uintptr_t) (slot->block.data + slot->block.length);
+	sqe->len = slot->wanted - slot->block.length;
+	sqe->off = slot->offset + slot->block.length;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+/*
+ * Starts a read into every free slot that has a block to read. A block with
+ * nothing to read is ready at once.
+ */
+int ring_fill(ReadAhead *ra)
+{
+	ReadSlot *slot;
+
+	while (readahead_take(ra, &slot)) {
+		if (slot->block.error || slot->wanted == 0) {
+			slot->state = SLOT_READY;
+		} else if (ring_submit(&ra->ring, slot, slot - ra->slots)) {
+			slot->block.error = -1;
+			slot->state = SLOT_READY;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Waits for at least one read to finish and marks the slots whose blocks are
+ * complete as ready. A read that comes back short is started again for the
+ * rest of its block, unless it hit the end of the file.
+ */
+int ring_wait(ReadAhead *ra)
+{
+	ReadRing *ring = &ra->ring;
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS,
+				NULL, 0) < 0)
+			if (errno != EINTR)
+				return -1;
+	}
+
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		unsigned long long user_data = cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+		ReadSlot *slot = &ra->slots[user_data];
+		if (res > 0)
+			slot->block.length += res;
+		if (res < 0 || (res > 0 && slot->block.length < slot->wanted &&
+				ring_submit(ring, slot, user_data)))
+			slot->block.error = -1;
+		else if (res > 0 && slot->block.length < slot->wanted)
+			continue;
+		slot->state = SLOT_READY;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,618 @@
+/*
+ * FreqRegex.c
+ *
+ * A parser for the POSIX extended regular expressions used by frequency.c. It
+ * does not match anything by itself; it turns a pattern into a syntax tree so
+ * that the scanner can recognize patterns that have a faster special-purpose
+ * implementation than regexec().
+ *
+ * The parser only accepts the subset of the syntax whose meaning does not depend
+ * on where regexec() starts looking: no anchors, back-references, GNU escapes or
+ * collating elements. Anything else is rejected and should be left to regexec().
+ *
+ * In order to use this file you must include ctype, stdbool, stdint, stdlib and
+ * string.
+ */
+
+#define REGEX_MAX_NODES 256
+#define REGEX_UNBOUNDED -1
+
+/* A set of bytes, one bit per byte value. */
+typedef struct {
+	uint8_t bits[32];
+} ByteSet;
+
+enum {
+	REGEX_EMPTY,
+	REGEX_SET,
+	REGEX_CAT,
+	REGEX_ALT,
+	REGEX_REPEAT,
+	REGEX_GROUP,
+};
+
+typedef struct {
+	int type;
+	int left, right; /* children; REPEAT and GROUP only use left */
+	int min, max; /* bounds of a REPEAT; max may be REGEX_UNBOUNDED */
+	int group; /* number of a GROUP, counting from 1 */
+	ByteSet set; /* bytes matched by a SET */
+} RegexNode;
+
+typedef struct {
+	RegexNode nodes[REGEX_MAX_NODES];
+	int count; /* number of nodes in use */
+	int root;
+	int ngroups;
+} Regex;
+
+
+/*
+ * Parses (pattern) into (re). If (icase) is true, the pattern is read the way
+ * regcomp() reads it under REG_ICASE.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: The pattern is malformed or uses syntax that this parser does not handle.
+ */
+int regex_parse(Regex *re, const char *pattern, bool icase);
+
+/*
+ * Determines whether (re) matches exactly (n) bytes from a single set and has
+ * no subexpressions, as in "[a-z]{3,3}" or "..". If so, puts the set in (set)
+ * and the length in (n) and returns true.
+ */
+bool regex_class_ngram(const Regex *re, ByteSet *set, int *n);
+
+/*
+ * Puts every byte that can begin a match of (re) into (first). Returns false if
+ * (re) can match the empty string, in which case a match can begin anywhere.
+ */
+bool regex_first_bytes(const Regex *re, ByteSet *first);
+
+/*
+ * Returns true if no match of (re) can be longer than some fixed length, i.e.
+ * it has no "*", "+" or "{m,}".
+ */
+bool regex_bounded(const Regex *re);
+
+/*
+ * Determines whether (re) is a run of bytes from a single set with one
+ * subexpression at a fixed position from the start or the end of the run, as
+ * in "[a-z]{2,2}([a-z])[a-z]*" or "[a-z]*([a-z])". If so, puts the set in (set),
+ * the shortest possible run in (min_length), the length of the subexpression in
+ * (length) and its offset in (offset). If (from_end) is true, the subexpression
+ * starts (offset) bytes before the end of the run; otherwise it starts (offset)
+ * bytes after the beginning.
+ */
+bool regex_positional(const Regex *re, ByteSet *set, int *min_length, int *offset,
+		int *length, bool *from_end);
+
+/*
+ * Returns true if (re) is an alternation of literal strings, as in "the|and",
+ * allowing for REG_ICASE.
+ */
+bool regex_literal_set(const Regex *re);
+
+bool byteset_has(const ByteSet *set, unsigned char c);
+void byteset_add(ByteSet *set, unsigned char c);
+void byteset_clear(ByteSet *set);
+bool byteset_equal(const ByteSet *x, const ByteSet *y);
+void byteset_union(ByteSet *dest, const ByteSet *src);
+
+int regex_node(Regex *re, int type);
+int regex_parse_alt(Regex *re, const char **p, bool icase);
+int regex_parse_cat(Regex *re, const char **p, bool icase);
+int regex_parse_atom(Regex *re, const char **p, bool icase);
+int regex_parse_bracket(ByteSet *set, const char **p, bool icase);
+int regex_parse_interval(const char **p, int *min, int *max);
+bool regex_class_ngram_walk(const Regex *re, int node, ByteSet *set, bool *have_set,
+		int *n);
+bool regex_first_walk(const Regex *re, int node, ByteSet *first);
+bool regex_literal_walk(const Regex *re, int node);
+int regex_flatten(const Regex *re, int node, int *items, int max);
+bool regex_fixed_run(const Regex *re, int node, ByteSet *set, bool *have_set, int *n);
+
+
+bool byteset_has(const ByteSet *set, unsigned char c)
+{
+	return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+void byteset_add(ByteSet *set, unsigned char c)
+{
+	set->bits[c >> 3] |= 1 << (c & 7);
+}
+
+void byteset_clear(ByteSet *set)
+{
+	memset(set->bits, 0, sizeof(set->bits));
+}
+
+bool byteset_equal(const ByteSet *x, const ByteSet *y)
+{
+	return memcmp(x->bits, y->bits, sizeof(x->bits)) == 0;
+}
+
+void byteset_union(ByteSet *dest, const ByteSet *src)
+{
+	size_t i;
+	for (i = 0; i < sizeof(dest->bits); ++i)
+		dest->bits[i] |= src->bits[i];
+}
+
+int regex_parse(Regex *re, const char *pattern, bool icase)
+{
+	re->count = 0;
+	re->ngroups = 0;
+
+	const char *p = pattern;
+	re->root = regex_parse_alt(re, &p, icase);
+	if (re->root < 0 || *p != '\0')
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Allocates a node of the given type and returns its index, or -1 if the
+ * pattern has too many nodes.
+ */
+int regex_node(Regex *re, int type)
+{
+	if (re->count == REGEX_MAX_NODES)
+		return -1;
+
+	RegexNode *node = &re->nodes[re->count];
+	memset(node, 0, sizeof(RegexNode));
+	node->type = type;
+	node->left = node->right = -1;
+	return re->count++;
+}
+
+int regex_parse_alt(Regex *re, const char **p, bool icase)
+{
+	int left = regex_parse_cat(re, p, icase);
+
+	while (left >= 0 && **p == '|') {
+		++*p;
+		int right = regex_parse_cat(re, p, icase);
+		if (right < 0) return -1;
+
+		int alt = regex_node(re, REGEX_ALT);
+		if (alt < 0) return -1;
+		re->nodes[alt].left = left;
+		re->nodes[alt].right = right;
+		left = alt;
+	}
+
+	return left;
+}
+
+int regex_parse_cat(Regex *re, const char **p, bool icase)
+{
+	int left = -1;
+
+	while (**p != '\0' && **p != '|' && **p != ')') {
+		int atom = regex_parse_atom(re, p, icase);
+		if (atom < 0) return -1;
+
+		/* Apply any number of quantifiers to the atom. */
+		while (**p == '*' || **p == '+' || **p == '?' || **p == '{') {
+			int min, max;
+			if (**p == '{') {
+				++*p;
+				if (regex_parse_interval(p, &min, &max)) return -1;
+			} else {
+				min = **p == '+' ? 1 : 0;
+				max = **p == '?' ? 1 : REGEX_UNBOUNDED;
+				++*p;
+			}
+
+			int repeat = regex_node(re, REGEX_REPEAT);
+			if (repeat < 0) return -1;
+			re->nodes[repeat].left = atom;
+			re->nodes[repeat].min = min;
+			re->nodes[repeat].max = max;
+			atom = repeat;
+		}
+
+		if (left < 0) {
+			left = atom;
+		} else {
+			int cat = regex_node(re, REGEX_CAT);
+			if (cat < 0) return -1;
+			re->nodes[cat].left = left;
+			re->nodes[cat].right = atom;
+			left = cat;
+		}
+	}
+
+	if (left < 0)
+		left = regex_node(re, REGEX_EMPTY);
+	return left;
+}
+
+int regex_parse_atom(Regex *re, const char **p, bool icase)
+{
+	unsigned char c = **p;
+	int node;
+
+	if (c == '(') {
+		++*p;
+		node = regex_node(re, REGEX_GROUP);
+		if (node < 0) return -1;
+		re->nodes[node].group = ++re->ngroups;
+
+		int inner = regex_parse_alt(re, p, icase);
+		if (inner < 0 || **p != ')') return -1;
+		++*p;
+		re->nodes[node].left = inner;
+		return node;
+	}
+
+	/* Anchors depend on where regexec() starts, and a quantifier cannot start
+	 * an atom.
+	 */
+	if (c == '^' || c == '$' || c == '*' || c == '+' || c == '?' || c == '{')
+		return -1;
+
+	node = regex_node(re, REGEX_SET);
+	if (node < 0) return -1;
+	ByteSet *set = &re->nodes[node].set;
+	byteset_clear(set);
+
+	if (c == '[') {
+		++*p;
+		if (regex_parse_bracket(set, p, icase)) return -1;
+		return node;
+	}
+
+	if (c == '.') {
+		++*p;
+		int i;
+		for (i = 1; i < 256; ++i)
+			byteset_add(set, i);
+		return node;
+	}
+
+	if (c == '\\') {
+		/* Only an escaped special character is a plain literal. Everything
+		 * else is a back-reference or a GNU extension.
+		 */
+		c = (*p)[1];
+		if (c == '\0' || strchr(".[]()*+?{}|^$\\", c) == NULL)
+			return -1;
+		++*p;
+	}
+
+	++*p;
+	if (icase) {
+		byteset_add(set, tolower(c));
+		byteset_add(set, toupper(c));
+	} else {
+		byteset_add(set, c);
+	}
+
+	return node;
+}
+
+/*
+ * Parses a bracket expression, starting just after the '['. Under REG_ICASE,
+ * regcomp() folds the pattern and the subject to lowercase before comparing
+ * them, so a byte matches if its lowercase form is in the bracket.
+ */
+int regex_parse_bracket(ByteSet *set, const char **p, bool icase)
+{
+	static const struct {
+		const char *name;
+		int (*f)(int c);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+	};
+
+	ByteSet raw;
+	byteset_clear(&raw);
+
+	bool negate = false;
+	if (**p == '^') {
+		negate = true;
+		++*p;
+	}
+
+	bool first = true;
+	while (**p != ']' || first) {
+		unsigned char lo = **p, hi;
+		if (lo == '\0') return -1;
+
+		if (lo == '[' && ((*p)[1] == '.' || (*p)[1] == '='))
+			return -1;
+
+		if (lo == '[' && (*p)[1] == ':') {
+			const char *name = *p + 2;
+			const char *end = strstr(name, ":]");
+			if (end == NULL) return -1;
+
+			size_t k, c;
+			for (k = 0; k < sizeof(classes)/sizeof(classes[0]); ++k)
+				if (strlen(classes[k].name) == (size_t) (end - name) &&
+						strncmp(classes[k].name, name, end - name) == 0)
+					break;
+
+			/* The case-folded forms of these are not worth getting right. */
+			if (k == sizeof(classes)/sizeof(classes[0]) ||
+					(icase && (classes[k].f == islower || classes[k].f == isupper)))
+				return -1;
+
+			for (c = 1; c < 256; ++c)
+				if (classes[k].f(c))
+					byteset_add(&raw, icase ? tolower(c) : c);
+			*p = end + 2;
+			first = false;
+			continue;
+		}
+
+		++*p;
+		hi = lo;
+		if (**p == '-' && (*p)[1] != ']' && (*p)[1] != '\0') {
+			hi = (*p)[1];
+			if (hi == '[') return -1;
+			*p += 2;
+		}
+
+		if (icase) {
+			lo = tolower(lo);
+			hi = tolower(hi);
+		}
+		if (hi < lo) return -1;
+
+		size_t c;
+		for (c = lo; c <= hi; ++c)
+			byteset_add(&raw, c);
+		first = false;
+	}
+	++*p;
+
+	/* regexec() never sees a NUL, since it ends the subject string. */
+	size_t c;
+	for (c = 1; c < 256; ++c)
+		if (byteset_has(&raw, icase ? tolower(c) : c) != negate)
+			byteset_add(set, c);
+
+	return 0;
+}
+
+/*
+ * Parses the inside of "{m}", "{m,}" or "{m,n}", starting just after the '{'.
+ */
+int regex_parse_interval(const char **p, int *min, int *max)
+{
+	if (!isdigit((unsigned char) **p)) return -1;
+
+	*min = (int) strtol(*p, (char **) p, 10);
+	*max = *min;
+	if (**p == ',') {
+		++*p;
+		*max = REGEX_UNBOUNDED;
+		if (isdigit((unsigned char) **p))
+			*max = (int) strtol(*p, (char **) p, 10);
+	}
+
+	if (**p != '}' || (*max != REGEX_UNBOUNDED && *max < *min))
+		return -1;
+	++*p;
+	return 0;
+}
+
+bool regex_class_ngram(const Regex *re, ByteSet *set, int *n)
+{
+	bool have_set = false;
+	*n = 0;
+	return re->ngroups == 0 &&
+			regex_class_ngram_walk(re, re->root, set, &have_set, n) &&
+			have_set && *n > 0;
+}
+
+bool regex_class_ngram_walk(const Regex *re, int node, ByteSet *set, bool *have_set,
+		int *n)
+{
+	const RegexNode *x = &re->nodes[node];
+
+	switch (x->type) {
+	case REGEX_SET:
+		if (*have_set && !byteset_equal(set, &x->set))
+			return false;
+		*set = x->set;
+		*have_set = true;
+		++*n;
+		return true;
+
+	case REGEX_CAT:
+		return regex_class_ngram_walk(re, x->left, set, have_set, n) &&
+				regex_class_ngram_walk(re, x->right, set, have_set, n);
+
+	case REGEX_REPEAT:
+		if (x->min != x->max || re->nodes[x->left].type != REGEX_SET ||
+				!regex_class_ngram_walk(re, x->left, set, have_set, n))
+			return false;
+		*n += x->min - 1;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool regex_first_bytes(const Regex *re, ByteSet *first)
+{
+	byteset_clear(first);
+	return !regex_first_walk(re, re->root, first);
+}
+
+/*
+ * Adds the bytes that can begin a match of (node) to (first), and returns true
+ * if (node) can match the empty string.
+ */
+bool regex_first_walk(const Regex *re, int node, ByteSet *first)
+{
+	const RegexNode *x = &re->nodes[node];
+	bool left, right;
+
+	switch (x->type) {
+	case REGEX_SET:
+		byteset_union(first, &x->set);
+		return false;
+
+	case REGEX_CAT:
+		if (!regex_first_walk(re, x->left, first))
+			return false;
+		return regex_first_walk(re, x->right, first);
+
+	case REGEX_ALT:
+		left = regex_first_walk(re, x->left, first);
+		right = regex_first_walk(re, x->right, first);
+		return left || right;
+
+	case REGEX_REPEAT:
+		if (x->max == 0)
+			return true;
+		return regex_first_walk(re, x->left, first) || x->min == 0;
+
+	case REGEX_GROUP:
+		return regex_first_walk(re, x->left, first);
+
+	default:
+		return true;
+	}
+}
+
+bool regex_bounded(const Regex *re)
+{
+	int i;
+	for (i = 0; i < re->count; ++i)
+		if (re->nodes[i].type == REGEX_REPEAT && re->nodes[i].max == REGEX_UNBOUNDED)
+			return false;
+
+	return true;
+}
+
+/*
+ * Puts the nodes of the concatenation at (node) into (items), in order, and
+ * returns how many there are, or -1 if there are more than (max).
+ */
+int regex_flatten(const Regex *re, int node, int *items, int max)
+{
+	if (re->nodes[node].type != REGEX_CAT) {
+		if (max < 1) return -1;
+		items[0] = node;
+		return 1;
+	}
+
+	int left = regex_flatten(re, re->nodes[node].left, items, max);
+	if (left < 0) return -1;
+	int right = regex_flatten(re, re->nodes[node].right, items + left, max - left);
+	if (right < 0) return -1;
+	return left + right;
+}
+
+/*
+ * Like regex_class_ngram_walk(), but also allows a subexpression around the
+ * whole node.
+ */
+bool regex_fixed_run(const Regex *re, int node, ByteSet *set, bool *have_set, int *n)
+{
+	if (re->nodes[node].type == REGEX_GROUP)
+		node = re->nodes[node].left;
+	return regex_class_ngram_walk(re, node, set, have_set, n);
+}
+
+bool regex_positional(const Regex *re, ByteSet *set, int *min_length, int *offset,
+		int *length, bool *from_end)
+{
+	int items[32];
+	int count = regex_flatten(re, re->root, items, 32);
+	if (count < 2 || re->ngroups != 1)
+		return false;
+
+	/* Exactly one item, at either end, may be an unbounded repeat. */
+	const RegexNode *first = &re->nodes[items[0]];
+	const RegexNode *last = &re->nodes[items[count - 1]];
+	int star;
+	if (last->type == REGEX_REPEAT && last->max == REGEX_UNBOUNDED)
+		star = count - 1;
+	else if (first->type == REGEX_REPEAT && first->max == REGEX_UNBOUNDED)
+		star = 0;
+	else
+		return false;
+
+	const RegexNode *x = &re->nodes[items[star]];
+	if (re->nodes[x->left].type != REGEX_SET)
+		return false;
+	*set = re->nodes[x->left].set;
+
+	bool have_set = true, seen_group = false;
+	int k, n, before = 0, after = 0;
+	*length = 0;
+	for (k = 0; k < count; ++k) {
+		if (k == star)
+			continue;
+
+		n = 0;
+		if (!regex_fixed_run(re, items[k], set, &have_set, &n))
+			return false;
+
+		if (re->nodes[items[k]].type == REGEX_GROUP) {
+			seen_group = true;
+			*length = n;
+		} else if (seen_group) {
+			after += n;
+		} else {
+			before += n;
+		}
+	}
+
+	if (!seen_group || *length == 0)
+		return false;
+
+	*min_length = before + *length + after + x->min;
+	*from_end = star == 0;
+	*offset = *from_end ? after + *length : before;
+	return true;
+}
+
+bool regex_literal_set(const Regex *re)
+{
+	return regex_literal_walk(re, re->root);
+}
+
+bool regex_literal_walk(const Regex *re, int node)
+{
+	const RegexNode *x = &re->nodes[node];
+	int c, members = 0, lower = -1;
+
+	switch (x->type) {
+	case REGEX_SET:
+		/* One byte, or one letter in both cases. */
+		for (c = 0; c < 256; ++c) {
+			if (byteset_has(&x->set, c)) {
+				if (members == 0) lower = tolower(c);
+				else if (tolower(c) != lower) return false;
+				++members;
+			}
+		}
+		return members > 0;
+
+	case REGEX_CAT:
+	case REGEX_ALT:
+		return regex_literal_walk(re, x->left) && regex_literal_walk(re, x->right);
+
+	case REGEX_GROUP:
+		return regex_literal_walk(re, x->left);
+
+	default:
+		return false;
+	}
+}
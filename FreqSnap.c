@@ -0,0 +1,213 @@
+/*
+ * FreqSnap.c
+ *
+ * A snapshot of the counts in a Hash, written to a file so that another
+ * process can add them to its own. Each snapshot records the job it belongs
+ * to, as a number that the writer makes up from whatever the counts depend
+ * on; a reader that expects another job treats the snapshot as stale. A
+ * snapshot of a job that has not finished also records how far the job got,
+ * so that it can go on from there.
+ *
+ * The layout is a SnapHeader, then for each key a uint32_t length, the bytes
+ * of the key and a double. Numbers are in the machine's byte order, since the
+ * snapshots are only passed between processes on one machine.
+ *
+ * In order to use this file you must include stdint, stdio, stdlib, string.h,
+ * sys/stat.h and unistd.h, and FreqHash.c.
+ */
+
+#define SNAP_MAGIC "FQSN"
+#define SNAP_VERSION 2
+
+/* A job for snap_read() that accepts a snapshot of any job. */
+#define SNAP_ANY_JOB UINT64_MAX
+
+/* How far the counts in a snapshot go, in whatever units the job uses. */
+typedef struct {
+	uint64_t file;
+	uint64_t offset; /* where to go on from in (file) */
+} SnapCursor;
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint64_t job;
+	uint64_t count; /* number of keys */
+	SnapCursor cursor;
+} SnapHeader;
+
+
+/*
+ * Writes the counts in (hash) to (snap_file), marked as part of (job) and as
+ * going as far as (cursor). The snapshot is written to a temporary file first,
+ * so a process that dies while writing one leaves no snapshot behind rather
+ * than half of one.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File write error, or out of memory.
+ */
+int snap_write(const char *snap_file, Hash hash, uint64_t job, SnapCursor cursor);
+
+/*
+ * Adds the counts in (snap_file) to (hash), if it is a snapshot of (job), and
+ * puts how far they go into (cursor) unless it is NULL. Nothing is added
+ * unless the whole snapshot can be read.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: There is no snapshot, or it could not be read, or out of memory.
+ * -2: The snapshot is of another job, or malformed.
+ */
+int snap_read(Hash *hash, const char *snap_file, uint64_t job, SnapCursor *cursor);
+
+/*
+ * Returns 0 if (snap_file) is a snapshot of (job), or what snap_read() would
+ * return if it is not, without reading the counts.
+ */
+int snap_check(const char *snap_file, uint64_t job);
+
+int snap_read_header(FILE *fp, SnapHeader *header, uint64_t job);
+
+
+int snap_write(const char *snap_file, Hash hash, uint64_t job, SnapCursor cursor)
+{
+	SnapHeader header;
+	size_t i, j;
+
+	memset(&header, 0, sizeof(SnapHeader));
+	memcpy(header.magic, SNAP_MAGIC, 4);
+	header.version = SNAP_VERSION;
+	header.job = job;
+	header.count = hash.count;
+	header.cursor = cursor;
+
+	size_t name_length = strlen(snap_file);
+	char *tmp_file = malloc(name_length + 8);
+	if (tmp_file == NULL) return -1;
+	memcpy(tmp_file, snap_file, name_length);
+	memcpy(tmp_file + name_length, ".XXXXXX", 8);
+
+	int fd = mkstemp(tmp_file);
+	FILE *fp = NULL;
+	if (fd >= 0) {
+		fp = fdopen(fd, "wb");
+		if (fp == NULL) close(fd);
+		else fchmod(fd, 0644);
+	}
+	int ret = fp ? 0 : -1;
+
+	if (ret == 0 && fwrite(&header, sizeof(SnapHeader), 1, fp) != 1) ret = -1;
+	for (i = 0; i < hash.length && ret == 0; ++i) {
+		for (j = 0; j < hash.buckets[i].length && ret == 0; ++j) {
+			const Pair *pair = &hash.buckets[i].pairs[j];
+			uint32_t length = strlen(pair->key);
+			if (fwrite(&length, sizeof(uint32_t), 1, fp) != 1 ||
+					fwrite(pair->key, 1, length, fp) != length ||
+					fwrite(&pair->value, sizeof(double), 1, fp) != 1)
+				ret = -1;
+		}
+	}
+
+	if (fp && fclose(fp)) ret = -1;
+	if (ret == 0 && rename(tmp_file, snap_file)) ret = -1;
+	if (ret && fd >= 0) remove(tmp_file);
+
+	free(tmp_file);
+	return ret;
+}
+
+int snap_read(Hash *hash, const char *snap_file, uint64_t job, SnapCursor *cursor)
+{
+	SnapHeader header;
+	Hash counts;
+	uint64_t i;
+	char *key = NULL;
+	size_t capacity = 0;
+	struct stat st;
+
+	FILE *fp = fopen(snap_file, "rb");
+	if (fp == NULL) return -1;
+	if (fstat(fileno(fp), &st)) {
+		fclose(fp);
+		return -1;
+	}
+
+	int ret = snap_read_header(fp, &header, job);
+	if (ret) {
+		fclose(fp);
+		return ret;
+	}
+
+	/* A key cannot be longer than the rest of the file, whatever its length
+	 * says, so a malformed length never asks for more memory than that.
+	 */
+	uint64_t left = (uint64_t) st.st_size - sizeof(SnapHeader);
+
+	/* The counts go into a hash of their own first, so that a snapshot that
+	 * ends early adds nothing.
+	 */
+	hash_init(&counts);
+	for (i = 0; i < header.count && ret == 0; ++i) {
+		uint32_t length;
+		double value;
+
+		if (fread(&length, sizeof(uint32_t), 1, fp) != 1) {
+			ret = -2;
+			break;
+		}
+		left -= sizeof(uint32_t);
+		if (length > left) {
+			ret = -2;
+			break;
+		}
+		if ((size_t) length + 1 > capacity) {
+			char *bigger = realloc(key, (size_t) length + 1);
+			if (bigger == NULL) {
+				ret = -1;
+				break;
+			}
+			key = bigger;
+			capacity = (size_t) length + 1;
+		}
+		if (fread(key, 1, length, fp) != length ||
+				fread(&value, sizeof(double), 1, fp) != 1) {
+			ret = -2;
+			break;
+		}
+		key[length] = '\0';
+		left -= length + sizeof(double);
+		hash_inc(&counts, key, value);
+	}
+
+	if (ret == 0)
+		hash_merge(hash, counts, 1);
+	if (ret == 0 && cursor)
+		*cursor = header.cursor;
+
+	hash_clear(&counts);
+	free(key);
+	fclose(fp);
+	return ret;
+}
+
+int snap_check(const char *snap_file, uint64_t job)
+{
+	SnapHeader header;
+
+	FILE *fp = fopen(snap_file, "rb");
+	if (fp == NULL) return -1;
+	int ret = snap_read_header(fp, &header, job);
+	fclose(fp);
+	return ret;
+}
+
+int snap_read_header(FILE *fp, SnapHeader *header, uint64_t job)
+{
+	if (fread(header, sizeof(SnapHeader), 1, fp) != 1)
+		return -2;
+	if (memcmp(header->magic, SNAP_MAGIC, 4) || header->version != SNAP_VERSION ||
+			(header->job != job && job != SNAP_ANY_JOB))
+		return -2;
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * FreqWindow.c
+ *
+ * Splits a text into windows by position, so that a corpus can be counted a
+ * part at a time, such as by chapter or by the years of a news file, in one
+ * pass. Positions are measured in bytes, lines or documents, which are the
+ * parts of the text between copies of a delimiter. A window covers (size)
+ * units, and a new window starts every (step) units: with a step equal to the
+ * size the windows are segments side by side, and with a smaller one they
+ * overlap and slide along the text.
+ *
+ * In order to use this file you must include stdint and string.h.
+ */
+
+typedef enum {
+	WINDOW_BYTES, WINDOW_LINES, WINDOW_DOCUMENTS
+} WindowUnit;
+
+/* A cursor that finds the unit of each offset in a text, going forward. */
+typedef struct {
+	WindowUnit unit;
+	uint64_t size, step; /* in units */
+	const char *text;
+	uint64_t length;
+	const char *delimiter; /* what ends a document */
+	size_t delimiter_length;
+	uint64_t units; /* the number of units in the text */
+
+	uint64_t current; /* the unit that window_unit() found last */
+	uint64_t boundary; /* where the unit after (current) starts */
+} Window;
+
+
+/*
+ * Sets up (window) for the (length) bytes of (text), in windows of (size)
+ * units that start every (step) units; neither may be 0. (delimiter) is only
+ * used for WINDOW_DOCUMENTS. Every text has at least one unit, even when it is
+ * empty, and a text with (n) delimiters has (n) + 1 documents.
+ */
+void window_init(Window *window, WindowUnit unit, uint64_t size, uint64_t step,
+		const char *text, uint64_t length, const char *delimiter,
+		size_t delimiter_length);
+
+/*
+ * Returns the unit that holds byte (offset) of the text, or the last unit if
+ * (offset) is the end of the text. The offsets that one Window is given must
+ * not go down.
+ */
+uint64_t window_unit(Window *window, uint64_t offset);
+
+/*
+ * Returns the number of windows. The last one ends at or after the last unit,
+ * so every unit is in at least one window unless the step is larger than the
+ * size.
+ */
+uint64_t window_count(const Window *window);
+
+/*
+ * Returns the offset of the first copy of the (delimiter_length) bytes of
+ * (delimiter) in (text) at or after (from), or (length) if there is none.
+ */
+uint64_t window_next_document(const char *text, uint64_t length, uint64_t from,
+		const char *delimiter, size_t delimiter_length);
+
+/*
+ * Returns where the first line after the newline at or after (from) starts, or
+ * where the first delimiter at or after (from) starts a document, or
+ * UINT64_MAX if there is none.
+ */
+uint64_t window_find(const Window *window, uint64_t from);
+
+uint64_t window_after(const Window *window, uint64_t boundary);
+
+
+void window_init(Window *window, WindowUnit unit, uint64_t size, uint64_t step,
+		const char *text, uint64_t length, const char *delimiter,
+		size_t delimiter_length)
+{
+	uint64_t at;
+
+	window->unit = unit;
+	window->size = size;
+	window->step = step;
+	window->text = text;
+	window->length = length;
+	window->delimiter = delimiter;
+	window->delimiter_length = delimiter_length;
+	window->current = 0;
+
+	if (unit == WINDOW_BYTES) {
+		window->units = length > 0 ? length : 1;
+		window->boundary = 1;
+		return;
+	}
+
+	/* The units are counted up front, so that the number of windows is known
+	 * before the first one is finished.
+	 */
+	window->units = 1;
+	for (at = window_find(window, 0); at != UINT64_MAX; at = window_after(window, at))
+		++window->units;
+	window->boundary = window_find(window, 0);
+}
+
+uint64_t window_unit(Window *window, uint64_t offset)
+{
+	if (window->unit == WINDOW_BYTES)
+		return offset < window->units ? offset : window->units - 1;
+
+	while (window->boundary <= offset && window->current + 1 < window->units) {
+		++window->current;
+		window->boundary = window_after(window, window->boundary);
+	}
+	return window->current;
+}
+
+uint64_t window_count(const Window *window)
+{
+	if (window->units <= window->size)
+		return 1;
+	return (window->units - window->size + window->step - 1) / window->step + 1;
+}
+
+uint64_t window_find(const Window *window, uint64_t from)
+{
+	if (window->unit == WINDOW_LINES) {
+		const char *newline = from < window->length ?
+				memchr(window->text + from, '\n', window->length - from) : NULL;
+		/* A newline at the very end starts no line. */
+		if (newline == NULL || newline + 1 == window->text + window->length)
+			return UINT64_MAX;
+		return newline + 1 - window->text;
+	}
+
+	if (window->delimiter_length == 0)
+		return UINT64_MAX;
+	uint64_t next = window_next_document(window->text, window->length, from,
+			window->delimiter, window->delimiter_length);
+	return next < window->length ? next : UINT64_MAX;
+}
+
+/* Returns where the unit after the one that starts at (boundary) starts. */
+uint64_t window_after(const Window *window, uint64_t boundary)
+{
+	if (window->unit == WINDOW_DOCUMENTS)
+		boundary += window->delimiter_length;
+	return window_find(window, boundary);
+}
+
+uint64_t window_next_document(const char *text, uint64_t length, uint64_t from,
+		const char *delimiter, size_t delimiter_length)
+{
+	while (from + delimiter_length <= length) {
+		const char *found = memchr(text + from, delimiter[0],
+				length - delimiter_length + 1 - from);
+		if (found == NULL)
+			break;
+		from = found - text;
+		if (memcmp(found, delimiter, delimiter_length) == 0)
+			return from;
+		++from;
+	}
+	return length;
+}
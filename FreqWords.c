@@ -0,0 +1,116 @@
+/*
+ * FreqWords.c
+ *
+ * Splits a buffer into words for find_n_words_for_file(). A word begins at an
+ * alphanumeric byte and runs through the alphanumerics and apostrophes that
+ * follow it, less one trailing apostrophe. The buffer is classified 64 bytes at
+ * a time into bitmasks of alphanumerics and apostrophes, and the words are read
+ * off the masks, so the work per byte has no branches; only the work per word
+ * does.
+ *
+ * In order to use this file you must include FreqClass.c.
+ */
+
+typedef struct {
+	uint64_t *offsets; /* word k runs from offsets[2k] up to offsets[2k+1] */
+	size_t length; /* number of words */
+	size_t capacity;
+} WordList;
+
+
+/*
+ * Finds the words in the first (length) bytes of (buffer) and puts their
+ * offsets in (words), which must be freed with words_free().
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: Out of memory.
+ */
+int words_tokenize(WordList *words, const char *buffer, uint64_t length);
+
+void words_free(WordList *words);
+
+int words_push(WordList *words, uint64_t start, uint64_t end);
+
+
+int words_tokenize(WordList *words, const char *buffer, uint64_t length)
+{
+	ByteSet set;
+	ByteClass alnum, apostrophe;
+	int c;
+
+	words->offsets = NULL;
+	words->length = words->capacity = 0;
+
+	byteset_clear(&set);
+	for (c = 0; c < 128; ++c)
+		if (isalnum(c))
+			byteset_add(&set, c);
+	byteclass_init(&alnum, &set);
+	byteset_clear(&set);
+	byteset_add(&set, '\'');
+	byteclass_init(&apostrophe, &set);
+
+	bool in_word = false;
+	uint64_t start = 0, base;
+
+	for (base = 0; base < length; base += 64) {
+		size_t block = length - base < 64 ? length - base : 64;
+		uint64_t a = byteclass_mask(&alnum, buffer + base, block);
+		uint64_t r = a | byteclass_mask(&apostrophe, buffer + base, block);
+		/* Bytes past the end of the buffer end any word. */
+		uint64_t done = ~r;
+		int pos = 0;
+
+		while (pos < 64) {
+			uint64_t from = ~(uint64_t) 0 << pos;
+			if (!in_word) {
+				if ((a & from) == 0) break;
+				pos = __builtin_ctzll(a & from);
+				start = base + pos;
+				in_word = true;
+			} else {
+				if ((done & from) == 0) break;
+				pos = __builtin_ctzll(done & from);
+				uint64_t end = base + pos;
+				if (buffer[end - 1] == '\'')
+					--end;
+				if (words_push(words, start, end))
+					return -1;
+				in_word = false;
+			}
+		}
+	}
+
+	/* A word that reaches the end of the buffer ends there. */
+	if (in_word) {
+		uint64_t end = buffer[length - 1] == '\'' ? length - 1 : length;
+		if (words_push(words, start, end))
+			return -1;
+	}
+
+	return 0;
+}
+
+int words_push(WordList *words, uint64_t start, uint64_t end)
+{
+	if (words->length == words->capacity) {
+		size_t capacity = words->capacity ? words->capacity * 2 : 1024;
+		uint64_t *offsets = realloc(words->offsets, sizeof(uint64_t) * 2 * capacity);
+		if (offsets == NULL) return -1;
+		words->offsets = offsets;
+		words->capacity = capacity;
+	}
+
+	words->offsets[2 * words->length] = start;
+	words->offsets[2 * words->length + 1] = end;
+	++words->length;
+	return 0;
+}
+
+void words_free(WordList *words)
+{
+	free(words->offsets);
+	words->offsets = NULL;
+	words->length = words->capacity = 0;
+}
@@ -1,108 +1,69 @@
 /* 
  * A C program designed to calculate frequency for given files. Main revision 
  * created 2011-12-26.
+ * 
+ * The counting itself is in libfrequency.c; this file is the command line.
  */
 
-#include <ctype.h>
-#include <regex.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "FreqHash.c"
-
-#define MAX_WORD_LEN 1000
+#include "libfrequency.c"
 
 #define ASCII_SHIFT 14
 
-#define CASE_SENSITIVE_P true
-#define CTRL_TO_ESCAPE_P true
+int print_sequence(FILE *stream, const char *sequence, bool ctrl_to_escape);
 
-#define MAX_TOKENS_TO_PRINT 0
+int print_pairs(const FreqContext *ctx, Pair *pairs, size_t length);
 
 /* 
- * Reads a number of files and calculates the aggregate frequency.
+ * Prints the count (value) to (stream). Word counts are whole numbers, but 
+ * regex matches are weighted by multiplier / matches, so they are fractions.
  */
-int freq_read_files(Hash *hash, const char *regex);
+void print_count(FILE *stream, double value);
 
 /* 
- * Reads a file and counts the frequency of each regex match.
- * hash: A hash in which to put the resulting matches, where each match is paired with the 
- *   number of times it occurs.
- * filename: The name of the file to be read.
- * regex: Each character sequence placed in hash must match this regular expression.
- * multiplier: A single instance of a sequence is counted as this many instances.
- * 
- * Return Codes
- * -0: Success.
- * -1: File read error.
- * -2: Invalid regular expression.
- * -3: File contains a sequence that exceeds the maximum length.
- * -4: Regular expression ran out of memory.
- * 
- */ 
-int freq_read_file(Hash *hash, const char *filename, const char *regex, int multiplier);
+ * Prints how much of each text (ctx) counted, and the scale from 
+ * freq_coverage().
+ */
+void print_coverage(FILE *stream, const FreqContext *ctx);
 
 /* 
- * Find all sequences of (wordcount) words. This does not work as a regex, so 
- * it has its own function.
+ * Prints each n-gram that (ctx) counted with its count and the number of 
+ * documents it is in, from the most frequent down.
  */
-int find_n_words(Hash *hash, int wordcount);
-int find_n_words_for_file(Hash *hash, const char *filename, int wordcount, int multiplier);
+int print_documents(const FreqContext *ctx);
 
-/* Increase the value of (sequence) in the hash function (hash).
+/* 
+ * Prints the counts of (window) as rows of a sparse matrix of windows by 
+ * keys, from the most frequent key down. (arg) is the FreqContext.
  */
-int freq_hash_inc(Hash *hash, char *sequence, double value, regmatch_t matchptr[]);
-
-/* Apply a filter to every char in (buffer).
-int filter_chars(char *buffer);
+int print_window(uint64_t window, Hash counts, void *arg);
 
-/* Scan a buffer and add regex matches to the hash.
+/* 
+ * Prints how much of the text that (dedup) was given it found to be copies.
  */
-int freq_scan(Hash *hash, char *buffer, uint64_t length, regex_t compiled, 
-		bool overlap, double adjusted_multiplier);
-
-bool legal_chars(const char *sequence, size_t length);
-
-int print_sequence(FILE *stream, const char *sequence, bool ctrl_to_escape);
-
-int read_file(char **buffer, uint64_t *length, const char *filename);
+void print_dedup(FILE *stream, const Dedup *dedup);
 
 /* 
- * REGEX CREATION TIPS
- *
- * If the regex contains a subexpression, this program will treat the first 
- * subexpression as the target text. You can use this to e.g. match the 
- * first letter in a word. The order of subexpressions is the order in which 
- * they begin.
+ * Updates the snapshot (snap_file) of the n-grams of (wordcount) words in 
+ * (old_file) to those in (new_file), as one edit from the first byte in which 
+ * they differ to the last, with find_n_words_edited().
  */
+int recount_file(FreqContext *ctx, const char *snap_file, int wordcount, 
+		const char *old_file, const char *new_file);
 
-#define FREQ_LETTER_CHARS "[a-z]"
-#define FREQ_LETTER_DIGRAPHS "[a-z]{2,2}"
-#define FREQ_LETTER_TRIGRAPHS "[a-z]{3,3}"
-#define FREQ_MAIN30_CHARS "[a-z.,;']"
-#define FREQ_MAIN30_DIGRAPHS "[a-z.,;']{2,2}"
-#define FREQ_MAIN30_TRIGRAPHS "[a-z.,;']{3,3}"
-#define FREQ_DIGRAPHS_NOSPC "[^\n\t ]{2,2}"
-#define FREQ_CHARS "."
-#define FREQ_DIGRAPHS ".."
-#define FREQ_TRIGRAPHS "..."
-
-// a word cannot have ' at beginning or end
-#define FREQ_WORDS "((([a-z])+('[a-z])?)+)"
-
-// BUG: Does not work for unknown reason.
-#define FREQ_NUMBERS "((\\+|-)?[0-9]+(\\.[0-9]+)?((e|E)[0-9]+)?)"
+/* 
+ * Compares the snapshots (file_a) and (file_b) with FreqDiff.c, and prints 
+ * the (n) keys with the most keyness, or every key if (n) is 0.
+ */
+int print_diff(const FreqContext *ctx, const char *file_a, const char *file_b, size_t n);
+int print_diff_row(const DiffRow *row, void *arg);
 
-#define FREQ_FIRST_LETTER "([a-z])[a-z]*"
-// BUG: these do not work because when the string fails to match, it is deleted
-#define FREQ_SECOND_LETTER "[a-z]([a-z])[a-z]*"
-#define FREQ_THIRD_LETTER "[a-z]{2,2}([a-z])[a-z]*"
-#define FREQ_LAST_LETTER "[a-z]*([a-z])"
-#define FREQ_FIRST_DIGRAPH "([a-z]{2,2})[a-z]*"
-#define FREQ_LAST_DIGRAPH "[a-z]*([a-z]{2,2})"
+/* 
+ * Times every regex backend, and the engine that the plan picks, on each of 
+ * the FREQ_* patterns for each of the (nfiles) files in (filenames), and prints 
+ * a table of the results. A backend whose match count differs from posix is 
+ * marked with a '*'.
+ */
+int freq_bench(FreqContext *ctx, const char **filenames, int nfiles);
 
 static const char *files[] = {
 	"000bigfiles/00allProse.txt", 
@@ -132,45 +93,434 @@ static int muls_no_prog[] = {
 
 int main(int argc, char const *argv[])
 {
-	Hash hash;
-	hash_init(&hash);
+	/* frequency --explain REGEX prints how REGEX would be scanned. */
+	if (argc == 3 && strcmp(argv[1], "--explain") == 0)
+		return plan_explain(stdout, argv[2]);
+	
+	FreqContext ctx;
+	freq_context_init(&ctx);
+	ctx.files = files;
+	ctx.multipliers = multipliers;
+	ctx.nfiles = sizeof(files)/sizeof(const char *);
+	ctx.word_files = files_no_prog;
+	ctx.word_multipliers = muls_no_prog;
+	ctx.nword_files = sizeof(files_no_prog)/sizeof(const char *);
+	int ret;
+	
+	/* frequency --norm-cache ... does what ... does, keeping FILE.norm next to 
+	 * each text it reads so that the next run need not fold it again. 
+	 */
+	if (argc >= 2 && strcmp(argv[1], "--norm-cache") == 0) {
+		ctx.use_norm_cache = true;
+		--argc;
+		++argv;
+	}
 	
-	// tests
-//	freq_read_file(&hash, "000bigfiles/test.txt", FREQ_MAIN30_CHARS, 1); // works
-//	freq_read_file(&hash, "000bigfiles/test.txt", FREQ_DIGRAPHS, 1); // works
-//	freq_read_file(&hash, "000bigfiles/test.txt", FREQ_NUMBERS, 1); // FAILS
-//	freq_read_file(&hash, "000bigfiles/02allC.txt", FREQ_CHARS, 1);
-//	find_n_words(&hash, 3);
+	/* frequency --bench [FILE...] compares the regex backends. */
+	if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+		if (argc == 2)
+			ret = freq_bench(&ctx, ctx.files, ctx.nfiles);
+		else
+			ret = freq_bench(&ctx, (const char **) argv + 2, argc - 2);
+		freq_context_free(&ctx);
+		return ret;
+	}
+	
+	/* frequency --tokenize TEXT IDS VOCAB writes a corpus of word IDs. */
+	if (argc == 5 && strcmp(argv[1], "--tokenize") == 0) {
+		ret = freq_tokenize_file(&ctx, argv[2], argv[3], argv[4]);
+		freq_context_free(&ctx);
+		return ret;
+	}
 	
-	find_n_words_for_file(&hash, "000bigfiles/0 prose/0 shakespeare DO NOT USE.txt", 2, 1);
+	// tests
+//	freq_read_file(&ctx, "000bigfiles/test.txt", FREQ_MAIN30_CHARS, 1); // works
+//	freq_read_file(&ctx, "000bigfiles/test.txt", FREQ_DIGRAPHS, 1); // works
+//	freq_read_file(&ctx, "000bigfiles/test.txt", FREQ_NUMBERS, 1); // FAILS
+//	freq_read_file(&ctx, "000bigfiles/02allC.txt", FREQ_CHARS, 1);
+//	find_n_words(&ctx, 3);
+	
+	/* frequency --words N IDS VOCAB counts the word n-grams of a corpus. */
+	if (argc == 5 && strcmp(argv[1], "--words") == 0)
+		ret = find_n_words_for_corpus(&ctx, argv[3], argv[4], atoi(argv[2]), 1);
+	/* frequency --stdin REGEX counts what is piped in, such as 
+	 * zcat corpus.gz | frequency --stdin REGEX. 
+	 */
+	else if (argc == 3 && strcmp(argv[1], "--stdin") == 0)
+		ret = freq_read_fd(&ctx, STDIN_FILENO, argv[2], 1);
+	/* frequency --read REGEX FILE... counts the files, reading ahead of the 
+	 * scan. 
+	 */
+	else if (argc >= 4 && strcmp(argv[1], "--read") == 0) {
+		int i, muls[argc - 3];
+		for (i = 0; i < argc - 3; ++i)
+			muls[i] = 1;
+		ctx.files = (const char **) argv + 3;
+		ctx.multipliers = muls;
+		ctx.nfiles = argc - 3;
+		ctx.read_ahead = true;
+		ret = freq_read_files(&ctx, argv[2]);
+	}
+	/* frequency --pipeline REGEX FILE... does the same with a thread for each 
+	 * stage, and reports how busy each one was. 
+	 */
+	else if (argc >= 4 && strcmp(argv[1], "--pipeline") == 0) {
+		int i, muls[argc - 3];
+		for (i = 0; i < argc - 3; ++i)
+			muls[i] = 1;
+		ctx.files = (const char **) argv + 3;
+		ctx.multipliers = muls;
+		ctx.nfiles = argc - 3;
+		ret = freq_read_files_pipeline(&ctx, argv[2], stderr);
+	}
+	/* frequency --dir REGEX DIR... counts every file under the directories, 
+	 * weighted as FreqDir.c says, on a thread for each processor. 
+	 */
+	else if (argc >= 4 && strcmp(argv[1], "--dir") == 0) {
+		ctx.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		ret = freq_read_dirs(&ctx, (const char **) argv + 3, argc - 3, argv[2]);
+	}
+	/* frequency --shard N SNAPDIR REGEX DIR... does the same in N processes, 
+	 * which leave their counts in SNAPDIR; run it again to finish a job whose 
+	 * workers failed. 
+	 */
+	else if (argc >= 6 && strcmp(argv[1], "--shard") == 0)
+		ret = freq_read_shards(&ctx, (const char **) argv + 5, argc - 5, argv[4], 
+				atoi(argv[2]), argv[3]);
+	/* frequency --checkpoint FILE words N counts the n-grams of N words in 
+	 * files_no_prog, and frequency --checkpoint FILE regex REGEX counts REGEX 
+	 * in files, saving the counts to FILE as they go. --resume in place of 
+	 * --checkpoint goes on from what FILE holds. 
+	 */
+	else if (argc == 5 && (strcmp(argv[1], "--checkpoint") == 0 || 
+			strcmp(argv[1], "--resume") == 0)) {
+		bool resume = strcmp(argv[1], "--resume") == 0;
+		if (strcmp(argv[3], "words") == 0)
+			ret = freq_read_checkpointed(&ctx, NULL, atoi(argv[4]), argv[2], resume);
+		else
+			ret = freq_read_checkpointed(&ctx, argv[4], 0, argv[2], resume);
+	}
+	/* frequency --within SECONDS REGEX FILE... counts the files for no longer 
+	 * than SECONDS, and says how much of each one it got to. 
+	 */
+	else if (argc >= 5 && strcmp(argv[1], "--within") == 0) {
+		int i, muls[argc - 4];
+		for (i = 0; i < argc - 4; ++i)
+			muls[i] = 1;
+		ctx.files = (const char **) argv + 4;
+		ctx.multipliers = muls;
+		ctx.nfiles = argc - 4;
+		freq_set_budget(&ctx, atof(argv[2]), 0);
+		ret = freq_read_files(&ctx, argv[3]);
+		if (ret == 0)
+			print_coverage(stderr, &ctx);
+	}
+	/* frequency --save SNAP REGEX FILE... counts the files and saves the table 
+	 * to SNAP as a FreqSnap.c snapshot, for --diff. 
+	 */
+	else if (argc >= 5 && strcmp(argv[1], "--save") == 0) {
+		int i, muls[argc - 4];
+		for (i = 0; i < argc - 4; ++i)
+			muls[i] = 1;
+		ctx.files = (const char **) argv + 4;
+		ctx.multipliers = muls;
+		ctx.nfiles = argc - 4;
+		ret = freq_read_files(&ctx, argv[3]);
+		if (ret == 0)
+			ret = snap_write(argv[2], ctx.hash, 0, (SnapCursor) { ctx.nfiles, 0 });
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	/* frequency --diff A B [N] compares two snapshots, such as those of --save 
+	 * or --checkpoint, and prints the N keys that moved the most, or every 
+	 * key if N is 0. 
+	 */
+	else if ((argc == 4 || argc == 5) && strcmp(argv[1], "--diff") == 0) {
+		ret = print_diff(&ctx, argv[2], argv[3], argc == 5 ? atol(argv[4]) : 50);
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	/* frequency --docs DELIMITER N FILE... counts the n-grams of N words in 
+	 * the files, and how many documents each one is in, where DELIMITER 
+	 * separates the documents in a file. 
+	 */
+	else if (argc >= 5 && strcmp(argv[1], "--docs") == 0) {
+		int i;
+		ctx.doc_delimiter = argv[2];
+		for (i = 4, ret = 0; i < argc && ret == 0; ++i)
+			ret = find_n_words_for_file(&ctx, argv[i], atoi(argv[3]), 1);
+		if (ret == 0)
+			ret = print_documents(&ctx);
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	/* frequency --window UNIT SIZE STEP N FILE [DELIMITER] counts the n-grams 
+	 * of N words in FILE in windows of SIZE bytes, lines or docs, as UNIT 
+	 * says, that start every STEP units, or every SIZE units if STEP is 0, 
+	 * and prints a row for each window and n-gram. DELIMITER separates the 
+	 * docs. 
+	 */
+	else if ((argc == 7 || argc == 8) && strcmp(argv[1], "--window") == 0) {
+		WindowUnit unit = strcmp(argv[2], "lines") == 0 ? WINDOW_LINES : 
+				strcmp(argv[2], "docs") == 0 ? WINDOW_DOCUMENTS : WINDOW_BYTES;
+		uint64_t size = strtoull(argv[3], NULL, 10);
+		uint64_t step = strtoull(argv[4], NULL, 10);
+		if (argc == 8)
+			ctx.doc_delimiter = argv[7];
+		if (size == 0 || atoi(argv[5]) < 1)
+			ret = -1;
+		else
+			ret = find_n_words_windowed(&ctx, argv[6], atoi(argv[5]), unit, size, 
+					step ? step : size, print_window, &ctx);
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	/* frequency --save-words SNAP N FILE... saves the n-grams of N words in 
+	 * the files to SNAP, and frequency --recount SNAP N OLD NEW updates such a 
+	 * snapshot of OLD after it was edited into NEW, counting only the text 
+	 * around the edit. 
+	 */
+	else if (argc >= 5 && strcmp(argv[1], "--save-words") == 0) {
+		int i;
+		for (i = 4, ret = 0; i < argc && ret == 0; ++i)
+			ret = find_n_words_for_file(&ctx, argv[i], atoi(argv[3]), 1);
+		if (ret == 0)
+			ret = snap_write(argv[2], ctx.hash, 0, (SnapCursor) { argc - 4, 0 });
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	else if (argc == 6 && strcmp(argv[1], "--recount") == 0) {
+		ret = recount_file(&ctx, argv[2], atoi(argv[3]), argv[4], argv[5]);
+		freq_context_free(&ctx);
+		return ret ? 1 : 0;
+	}
+	/* frequency --dedup MODE REGEX FILE... counts the files, skipping each one 
+	 * that is a copy of one before it, and with MODE chunks or a number of 
+	 * bytes, each block of a file that is a copy of one before it as well, 
+	 * where the blocks are cut by content or are of that size. MODE files 
+	 * skips only whole files. --dedup-dir REGEX DIR... skips the files under 
+	 * the directories that are copies of others. 
+	 */
+	else if ((argc >= 5 && strcmp(argv[1], "--dedup") == 0) || 
+			(argc >= 4 && strcmp(argv[1], "--dedup-dir") == 0)) {
+		Dedup dedup;
+		bool dir = strcmp(argv[1], "--dedup-dir") == 0;
+		const char *mode = dir ? "files" : argv[2];
+		ret = dedup_init(&dedup, strcmp(mode, "files") == 0 ? DEDUP_TEXTS : 
+				strcmp(mode, "chunks") == 0 ? DEDUP_CHUNKS : DEDUP_BLOCKS, 
+				strtoull(mode, NULL, 10));
+		ctx.dedup = &dedup;
+		if (ret == 0 && dir) {
+			ctx.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+			ret = freq_read_dirs(&ctx, (const char **) argv + 3, argc - 3, argv[2]);
+		} else if (ret == 0) {
+			int i, muls[argc - 4];
+			for (i = 0; i < argc - 4; ++i)
+				muls[i] = 1;
+			ctx.files = (const char **) argv + 4;
+			ctx.multipliers = muls;
+			ctx.nfiles = argc - 4;
+			ret = freq_read_files(&ctx, argv[3]);
+		}
+		if (ret == 0)
+			print_dedup(stderr, &dedup);
+		dedup_free(&dedup);
+		ctx.dedup = NULL;
+	}
+	else
+		ret = find_n_words_for_file(&ctx, "000bigfiles/0 prose/0 shakespeare DO NOT USE.txt", 2, 1);
+	if (ret) {
+		freq_context_free(&ctx);
+		return 1;
+	}
 	
 	Pair *pairs;
 	size_t length;
-	hash_sort(&pairs, &length, hash);
+	if (hash_sort(&pairs, &length, ctx.hash)) {
+		freq_context_free(&ctx);
+		return 1;
+	}
 	
-	if (MAX_TOKENS_TO_PRINT > 0 && length > MAX_TOKENS_TO_PRINT)
-		length = MAX_TOKENS_TO_PRINT;
+	if (ctx.max_tokens_to_print > 0 && length > ctx.max_tokens_to_print)
+		length = ctx.max_tokens_to_print;
 	
-	print_pairs(pairs, length);
+	print_pairs(&ctx, pairs, length);
 	
-	hash_clear(&hash);
+	freq_context_free(&ctx);
 	free(pairs);
 		
 	return 0;
 }
 
-int print_pairs(Pair *pairs, size_t length)
+int print_pairs(const FreqContext *ctx, Pair *pairs, size_t length)
 {
 	size_t i;
 	for (i = 0; i < length; ++i) {
-		print_sequence(stdout, pairs[i].key, CTRL_TO_ESCAPE_P);
-		printf(" %lld\n", (long long) (pairs[i].value));
+		print_sequence(stdout, pairs[i].key, ctx->ctrl_to_escape);
+		printf(" ");
+		print_count(stdout, pairs[i].value);
+		printf("\n");
 	}
 	
 	printf("\n");
 	return 0;	
 }
 
+void print_count(FILE *stream, double value)
+{
+	if (value == (double) (long long) value)
+		fprintf(stream, "%lld", (long long) value);
+	else
+		fprintf(stream, "%.8g", value);
+}
+
+void print_coverage(FILE *stream, const FreqContext *ctx)
+{
+	const FreqCoverage *coverage;
+	size_t i, length;
+	double scale = freq_coverage(ctx, &coverage, &length);
+	
+	for (i = 0; i < length; ++i) {
+		fprintf(stream, "%s: %llu of %llu bytes", coverage[i].name ? coverage[i].name : "-", 
+				coverage[i].scanned, coverage[i].size);
+		if (coverage[i].size > 0)
+			fprintf(stream, " (%.1f%%)", 100.0 * coverage[i].scanned / coverage[i].size);
+		fprintf(stream, "\n");
+	}
+	fprintf(stream, "scale %g\n", scale);
+}
+
+void print_dedup(FILE *stream, const Dedup *dedup)
+{
+	fprintf(stream, "skipped %llu of %llu bytes", 
+			(unsigned long long) dedup->skipped_bytes, (unsigned long long) dedup->bytes);
+	if (dedup->bytes > 0)
+		fprintf(stream, " (%.1f%%)", 100.0 * dedup->skipped_bytes / dedup->bytes);
+	fprintf(stream, ", %llu whole texts\n", (unsigned long long) dedup->skipped_texts);
+}
+
+int print_documents(const FreqContext *ctx)
+{
+	Pair *pairs;
+	size_t i, length;
+	
+	if (hash_sort(&pairs, &length, ctx->hash))
+		return -1;
+	if (ctx->max_tokens_to_print > 0 && length > ctx->max_tokens_to_print)
+		length = ctx->max_tokens_to_print;
+	
+	for (i = 0; i < length; ++i) {
+		const Pair *docs = hash_find(ctx->docs, pairs[i].key, pairs[i].hashval);
+		print_sequence(stdout, pairs[i].key, ctx->ctrl_to_escape);
+		printf(" ");
+		print_count(stdout, pairs[i].value);
+		printf(" %lld\n", (long long) (docs ? docs->value : 0));
+	}
+	fprintf(stderr, "%llu documents\n", (unsigned long long) ctx->ndocs);
+	
+	free(pairs);
+	return 0;
+}
+
+int print_window(uint64_t window, Hash counts, void *arg)
+{
+	const FreqContext *ctx = arg;
+	Pair *pairs;
+	size_t i, length;
+	
+	if (hash_sort(&pairs, &length, counts))
+		return -1;
+	for (i = 0; i < length; ++i) {
+		printf("%llu\t", (unsigned long long) window);
+		print_sequence(stdout, pairs[i].key, ctx->ctrl_to_escape);
+		printf("\t");
+		print_count(stdout, pairs[i].value);
+		printf("\n");
+	}
+	
+	free(pairs);
+	return 0;
+}
+
+int recount_file(FreqContext *ctx, const char *snap_file, int wordcount, 
+		const char *old_file, const char *new_file)
+{
+	char *old_text, *new_text;
+	uint64_t old_length, new_length, prefix = 0, suffix = 0;
+	SnapCursor cursor;
+	
+	int ret = snap_read(&ctx->hash, snap_file, 0, &cursor);
+	if (ret) return ret;
+	if (read_file(&old_text, &old_length, old_file, true))
+		return -1;
+	if (read_file(&new_text, &new_length, new_file, true)) {
+		free(old_text);
+		return -1;
+	}
+	
+	while (prefix < old_length && prefix < new_length && 
+			old_text[prefix] == new_text[prefix])
+		++prefix;
+	while (suffix < old_length - prefix && suffix < new_length - prefix && 
+			old_text[old_length - suffix - 1] == new_text[new_length - suffix - 1])
+		++suffix;
+	
+	FreqEdit edit = { prefix, old_text + prefix, old_length - prefix - suffix, 
+			new_length - prefix - suffix };
+	ret = find_n_words_edited(ctx, new_file, wordcount, 1, &edit, 1);
+	if (ret == 0)
+		ret = snap_write(snap_file, ctx->hash, 0, cursor);
+	
+	free(old_text);
+	free(new_text);
+	return ret;
+}
+
+int print_diff(const FreqContext *ctx, const char *file_a, const char *file_b, size_t n)
+{
+	Hash a, b;
+	DiffSummary summary;
+	int ret;
+	
+	hash_init(&a);
+	hash_init(&b);
+	ret = snap_read(&a, file_a, SNAP_ANY_JOB, NULL);
+	if (ret == 0)
+		ret = snap_read(&b, file_b, SNAP_ANY_JOB, NULL);
+	
+	if (ret == 0) {
+		printf("key\ta\tb\tdelta\tratio\tkeyness\n");
+		if (n == 0) {
+			ret = diff_tables(a, b, print_diff_row, (void *) ctx, &summary);
+		} else {
+			DiffRow *rows;
+			size_t i, length;
+			ret = diff_top(a, b, &rows, &length, n, &summary);
+			for (i = 0; ret == 0 && i < length; ++i)
+				print_diff_row(&rows[i], (void *) ctx);
+			if (ret == 0) free(rows);
+		}
+	}
+	
+	if (ret == 0)
+		fprintf(stderr, "totals %g and %g; %zu keys only in %s, %zu only in %s, %zu in both\n", 
+				summary.total_a, summary.total_b, summary.only_a, file_a, 
+				summary.only_b, file_b, summary.both);
+	
+	hash_clear(&a);
+	hash_clear(&b);
+	return ret;
+}
+
+int print_diff_row(const DiffRow *row, void *arg)
+{
+	const FreqContext *ctx = arg;
+	print_sequence(stdout, row->key, ctx->ctrl_to_escape);
+	printf("\t%g\t%g\t%g\t%g\t%g\n", row->a, row->b, row->delta, row->ratio, 
+			row->keyness);
+	return 0;
+}
+
 int print_pairs_short(Pair *pairs, size_t length)
 {
 	size_t i;
@@ -183,7 +533,7 @@ int print_pairs_short(Pair *pairs, size_t length)
 	return 0;	
 }
 
-int freq_read_files_programming(Hash *hash, const char *regex)
+int freq_read_files_programming(FreqContext *ctx, const char *regex)
 {
 	const char *test_files[] = {
 		"000bigfiles/02allC.txt", 
@@ -197,7 +547,7 @@ int freq_read_files_programming(Hash *hash, const char *regex)
 	int ret = 0;
 	size_t i;
 	for (i = 0; i < sizeof(test_files)/sizeof(const char *); ++i) {
-		ret = freq_read_file(hash, test_files[i], regex, test_muls[i]);
+		ret = freq_read_file(ctx, test_files[i], regex, test_muls[i]);
 		if (ret) return ret;
 		printf("done with %s at %d\n", test_files[i], test_muls[i]);
 	}
@@ -205,7 +555,7 @@ int freq_read_files_programming(Hash *hash, const char *regex)
 	return ret;	
 }
 
-int freq_read_files_test(Hash *hash, const char *regex)
+int freq_read_files_test(FreqContext *ctx, const char *regex)
 {
 	const char *files[] = {
 		"000bigfiles/test.txt", 
@@ -217,7 +567,7 @@ int freq_read_files_test(Hash *hash, const char *regex)
 	int ret = 0;
 	size_t i;
 	for (i = 0; i < sizeof(files)/sizeof(const char *); ++i) {
-		ret = freq_read_file(hash, files[i], regex, multipliers[i]);
+		ret = freq_read_file(ctx, files[i], regex, multipliers[i]);
 		if (ret) return ret;
 		printf("done with %s at %d\n", files[i], multipliers[i]);
 	}
@@ -225,225 +575,83 @@ int freq_read_files_test(Hash *hash, const char *regex)
 	return ret;
 }
 
-/* 
- * Reads the global array `files` and calls `freq_read_file()` on each
- * file in the array.
- */
-int freq_read_files(Hash *hash, const char *regex)
-{
-	int ret = 0;
-	size_t i;
-	for (i = 0; i < sizeof(files)/sizeof(const char *); ++i) {
-		ret = freq_read_file(hash, files[i], regex, multipliers[i]);
-		if (ret) return ret;
-		printf("done with %s at %d\n", files[i], multipliers[i]);
-	}
-	
-	return ret;
-}
-
-int filter_chars(char *buffer)
-{
-	size_t i, length = strlen(buffer);
-	for (i = 0; i < length; ++i) {
-		buffer[i] = (char) tolower((int) buffer[i]);
-	}
-	
-	return 0;
-}
-
-/*
- * Reads the file at `filename`. Finds all matches for the given
- * regular expression and counts their frequency, storing the result
- * in `hash`. The frequencies are multiplied by `multiplier`. Use this
- * if you want to read multiple files and weight some more heavily
- * than others.
- */
-int freq_read_file(Hash *hash, const char *filename, const char *regex, int multiplier)
-{
-	int matches = 0;
-	regmatch_t matchptr[2], prev_matchptr[2];
-	
-	/* For fixed-length sequences, look for overlaps. For variable-length 
-	 * sequences, do not.
-	 */
-
-	bool overlap = true;
-	if (strchr(regex, '+') || strchr(regex, '*'))
-		overlap = false;
-	
-	regex_t compiled;
-	int ret = regcomp(&compiled, regex, REG_EXTENDED | REG_ICASE);
-	if (ret) return -2;
-	 
-	char *buffer = NULL;
-	uint64_t length = 0;
-	ret = read_file(&buffer, &length, filename);
-	if (ret) {
-		regfree(&compiled);
-		return ret;
-	}
-	
-	filter_chars(buffer);
-
-	/* Count the number of regex matches in the file. */
-	int count = freq_scan(NULL, buffer, length, compiled, overlap, 1);
-	double adjusted_multiplier = (double) multiplier / count;
-	
-	freq_scan(hash, buffer, length, compiled, overlap, adjusted_multiplier);
-	
-	free(buffer);
-	regfree(&compiled);
-			
-	return matches;
-}
-
-/* 
- * Finds all n-grams of (wordcount) words. Uses all files except for 
- * programming files.
- */
-int find_n_words(Hash *hash, int wordcount)
+int freq_bench(FreqContext *ctx, const char **filenames, int nfiles)
 {
-	int ret = 0;
-	size_t i;
-	for (i = 0; i < sizeof(files_no_prog)/sizeof(const char *); ++i) {
-		ret = find_n_words_for_file(hash, files_no_prog[i], wordcount, 
-				muls_no_prog[i]);
-		if (ret) return ret;
-		printf("done with %s at %d\n", files_no_prog[i], muls_no_prog[i]);
-	}
-	
-	return ret;	
-}
-
-int find_n_words_for_file(Hash *hash, const char *filename, int wordcount, int multiplier)
-{
-	char *buffer = NULL;
-	uint64_t i = 0, next_i = 0, length = 0;
-	int ret = 0;
-	
-	ret = read_file(&buffer, &length, filename);
-	if (ret)
-		return ret;
-	
-	filter_chars(buffer);
-	char words[(MAX_WORD_LEN + 1) * wordcount];
-	size_t j, k;
-	
-	while (i < length) {
-		i = next_i;			
-		j = 0;
+	size_t npatterns = sizeof(freq_patterns) / sizeof(freq_patterns[0]);
+	size_t nbackends = sizeof(regex_backends) / sizeof(regex_backends[0]);
+	struct timespec start, stop;
+	size_t p, b;
+	int f, ret;
+	
+	for (f = 0; f < nfiles; ++f) {
+		NormText norm;
+		ret = read_normalized(ctx, &norm, filenames[f]);
+		if (ret) {
+			fprintf(stderr, "%s: could not read\n", filenames[f]);
+			return ret;
+		}
+		char *buffer = norm.text;
+		uint64_t length = norm.length;
 		
-		for (k = 0; i < length && k < wordcount; ++k) {
-			while (i < length && !isalnum(buffer[i]))
-				++i;
+		printf("%s (%llu bytes), in ms\n%-24s", filenames[f], 
+				(unsigned long long) length, "pattern");
+		for (b = 0; b < nbackends; ++b)
+			printf("%12s", regex_backends[b]->name);
+		printf("%12s\n", "plan");
+		
+		for (p = 0; p < npatterns; ++p) {
+			const char *regex = freq_patterns[p].regex;
+			Plan plan;
+			plan_pattern(&plan, regex);
 			
-			if (k > 0) words[j++] = ' ';
+			/* Give every backend the same prefilter that the plan would. */
+			ByteSet first = plan.first;
+			ByteClass prefilter;
+			byteset_add(&first, '\0');
+			byteclass_init(&prefilter, &first);
+			bool has_first = plan.engine != ENGINE_REGEXEC;
 			
-			/* Match a word. */
-			if (i < length && isalnum(buffer[i])) {
-				while (i < length && 
-						(isalnum(buffer[i]) || buffer[i] == '\'')) {
-					words[j++] = buffer[i++];					
-				}
-				if (buffer[i-1] == '\'') {
-					--i; --j;
+			printf("%-24s", freq_patterns[p].name);
+			int expected = -1;
+			for (b = 0; b < nbackends; ++b) {
+				void *state;
+				if (regex_backends[b]->compile(&state, regex)) {
+					printf("%12s", "n/a");
+					continue;
 				}
-			}
 				
-			if (k == 0) next_i = i;
-		}
-		
-		/* Only add this set of words to the hash if the above loop did not 
-		 * reach EOF before completion.
-		 */
-		if (k == wordcount) {
-			words[j] = '\0';
-			hash_inc(hash, words, multiplier);
-		} else {
-			break;
-		}
-	}
-	
-	return 0;
-}
-
-int freq_scan(Hash *hash, char *buffer, uint64_t length, regex_t compiled, bool overlap, double adjusted_multiplier)
-{
-	int ret = 0;
-	regmatch_t matchptr[2];
-	
-	int matches = 0;
-	uint64_t i = 0;
-	
-	while (i < length) {
-		matchptr[0].rm_so = matchptr[0].rm_eo = 0;	
-		matchptr[1].rm_so = matchptr[1].rm_eo = 0;	
-
-		/* Limit the string size to MAX_WORD_LEN so that the regular expression 
-		 * only tries to match the first MAX_WORD_LEN characters, instead of 
-		 * the entire file.
-		 */
-		char holder = buffer[i + MAX_WORD_LEN];
-		buffer[i + MAX_WORD_LEN] = '\0';
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				int count = freq_scan(ctx, NULL, buffer, length, regex_backends[b], state, 
+						plan.overlap, has_first ? &prefilter : NULL, 1, NULL);
+				clock_gettime(CLOCK_MONOTONIC, &stop);
+				regex_backends[b]->free(state);
 				
-		if ((ret = regexec(&compiled, buffer + i, 2, matchptr, 0)) == 0) {
-			if (hash) {
-				freq_hash_inc(hash, buffer + i, adjusted_multiplier, matchptr);
+				if (b == 0) expected = count;
+				printf("%11.1f%c", (stop.tv_sec - start.tv_sec) * 1e3 + 
+						(stop.tv_nsec - start.tv_nsec) / 1e6, 
+						count == expected ? ' ' : '*');
+			}
+			
+			void *state;
+			if (plan.backend->compile(&state, regex)) {
+				printf("%12s\n", "n/a");
+				continue;
 			}
-			++matches;
-		} else if (ret == REG_ESPACE) {
-			return -4;
-		} else break; /* There are no more matches. */
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			int count = freq_scan_plan(ctx, NULL, buffer, length, &plan, state, norm.legal, 1, 
+					NULL);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			plan.backend->free(state);
+			printf("%11.1f%c\n", (stop.tv_sec - start.tv_sec) * 1e3 + 
+					(stop.tv_nsec - start.tv_nsec) / 1e6, 
+					count == expected ? ' ' : '*');
+		}
 		
-		buffer[i + MAX_WORD_LEN] = holder;
-
-		if (overlap) i += matchptr[0].rm_so + 1;
-		else i += matchptr[0].rm_eo;
-	}	
-	
-	if (hash == NULL) return matches;
-	else return 0;
-}
-
-int freq_hash_inc(Hash *hash, char *sequence, double value, regmatch_t matchptr[])
-{
-	size_t length;
-	
-	/* If the regex contained at least one subexpression, use the sequence 
-	 * contained within the first subexpression. Otherwise, uses the 
-	 * complete sequence.
-	 */
-	if (matchptr[1].rm_so != matchptr[1].rm_eo) {
-		sequence += matchptr[1].rm_so;
-		length = matchptr[1].rm_eo - matchptr[1].rm_so;
-	} else {
-		sequence += matchptr[0].rm_so;
-		length = matchptr[0].rm_eo - matchptr[0].rm_so;
-	}
-
-	/* Do not add the sequence if it contains any illegal characters. */
-	if (!legal_chars(sequence, length)) return 0;
-	
-	char saved = sequence[length];
-	sequence[length] = '\0';
-	int ret = hash_inc(hash, sequence, value);
-	sequence[length] = saved;
-	return ret;
-}
-
-bool legal_chars(const char *sequence, size_t length)
-{
-	size_t i;
-	char c;
-	for (i = 0; i < length; ++i) {
-		c = sequence[i];
-		if (!isprint(c) && c != '\n' && c != '\t')
-			return false;
-		++sequence;
+		printf("\n");
+		norm_close(&norm);
 	}
 	
-	return true;
+	return 0;
 }
 
 int print_sequence(FILE *stream, const char *sequence, bool ctrl_to_escape)
@@ -467,32 +675,3 @@ int print_sequence(FILE *stream, const char *sequence, bool ctrl_to_escape)
 	
 	return 0;
 }
-
-/* 
- * This may be inefficient on 32-bit machines, but if length is declared as size_t then 
- * this function cannot be guaranteed to work for ASCII files larger than 4 GB.
- */
-int read_file(char **buffer, uint64_t *length, const char *filename)
-{
-	FILE *fp = fopen(filename, "r");
-	if (fp == NULL) return -1;
-	
-	uint64_t i, tmp_length = 256;
-	*buffer = malloc(sizeof(char) * tmp_length);
-	char c;
-	for (i = 0; (c = fgetc(fp)) != EOF; ++i) {
-		if (i == tmp_length) {
-			tmp_length *= 4;
-			*buffer = realloc(*buffer, sizeof(char) * tmp_length);
-		}
-		
-		if (!CASE_SENSITIVE_P) c = tolower(c);
-
-		(*buffer)[i] = c;
-	}
-		
-	fclose(fp);
-	(*buffer)[i] = '\0';
-	*length = i;
-	return 0;
-}
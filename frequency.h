@@ -0,0 +1,167 @@
+/*
+ * frequency.h
+ *
+ * The interface to libfrequency, which counts how often each match of a
+ * regular expression occurs in a text. The text can come from a file, or be
+ * pushed in pieces of any size as it arrives:
+ *
+ *   FreqContext *ctx = freq_new();
+ *   freq_begin(ctx, FREQ_LETTER_DIGRAPHS, 1);
+ *   while ((length = read(fd, bytes, sizeof(bytes))) > 0)
+ *     freq_feed(ctx, bytes, length);
+ *   freq_end(ctx);
+ *   freq_foreach(ctx, print_count, NULL);
+ *   freq_delete(ctx);
+ *
+ * A text that is pushed in is counted the same as a file that holds the same
+ * bytes, however it is split up. The FREQ_* patterns are in FreqPatterns.h.
+ *
+ * In order to use this file you must include stddef.h.
+ */
+
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+
+typedef struct FreqContext FreqContext;
+
+/* How much of one text was counted; see freq_coverage(). */
+typedef struct {
+	const char *name; /* the file, or NULL for a text given to freq_feed() */
+	unsigned long long scanned; /* bytes counted */
+	unsigned long long size; /* bytes in the text, or 0 if not known */
+	int multiplier;
+} FreqCoverage;
+
+/*
+ * Returns a new context with the default configuration and no counts, or NULL
+ * if out of memory. It must be freed with freq_delete().
+ */
+FreqContext * freq_new(void);
+
+void freq_delete(FreqContext *ctx);
+
+/*
+ * Reads a file and counts the frequency of each regex match. The file is
+ * noted in the coverage, and with a budget it is counted the way freq_read_fd()
+ * counts its input, so that it stops once the budget has run out.
+ * ctx: The context whose hash gets the resulting matches, where each match is paired
+ *   with the number of times it occurs.
+ * filename: The name of the file to be read.
+ * regex: Each character sequence placed in hash must match this regular expression.
+ * multiplier: A single instance of a sequence is counted as this many instances.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File read error.
+ * -2: Invalid regular expression.
+ * -3: File contains a sequence that exceeds the maximum length.
+ * -4: Regular expression ran out of memory.
+ *
+ */
+int freq_read_file(FreqContext *ctx, const char *filename, const char *regex, int multiplier);
+
+/* One change to a file: the (old_length) bytes of (old_text) that were at
+ * (offset) are now (new_length) other bytes. (offset) is where they were
+ * before any of the changes.
+ */
+typedef struct {
+	unsigned long long offset;
+	const char *old_text;
+	unsigned long long old_length;
+	unsigned long long new_length;
+} FreqEdit;
+
+/*
+ * Brings the counts in (ctx) of the n-grams of (wordcount) words in
+ * (filename), counted with (multiplier), up to date with the (nedits) changes
+ * in (edits) that have been made to the file since, such as counts read back
+ * from a snapshot. The edits must be in order and must not overlap. Only the
+ * text around each edit is read: the n-grams that it held before the edit are
+ * taken out of the counts and those that it holds now are added, so the
+ * counts come out as a new count of the whole file would. The document counts
+ * are left as they are. Nothing is changed unless this succeeds.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File read error, or out of memory.
+ * -2: The case is kept and an edit puts in or takes out a NUL, which changes
+ *     how all the text after it is folded, so the file must be counted again
+ *     whole.
+ * -3: The edits are out of order, overlap or go past the end of the file.
+ */
+int find_n_words_edited(FreqContext *ctx, const char *filename, int wordcount,
+		int multiplier, const FreqEdit *edits, size_t nedits);
+
+/*
+ * Reads (fd) to its end, such as a pipe or standard input, and counts it as
+ * freq_read_file() would count a file. The input is read in blocks of a fixed
+ * size and counted as it arrives, so it need not fit in memory.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: Read error, or out of memory.
+ * -2: Invalid regular expression.
+ * -4: Regular expression ran out of memory.
+ */
+int freq_read_fd(FreqContext *ctx, int fd, const char *regex, int multiplier);
+
+/*
+ * Starts a text that will be given to freq_feed(), to be counted as if by
+ * freq_read_file() with (regex) and (multiplier). Only one text can be open in
+ * (ctx) at a time.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: Out of memory, or a text is already open.
+ * -2: Invalid regular expression.
+ */
+int freq_begin(FreqContext *ctx, const char *regex, int multiplier);
+
+/*
+ * Adds the next (length) bytes of the text. A match may span two calls. Only
+ * the bytes that are still needed are kept, which is at most twice the
+ * maximum match length plus (length).
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: Out of memory, or no text is open.
+ * -4: Regular expression ran out of memory.
+ */
+int freq_feed(FreqContext *ctx, const char *bytes, size_t length);
+
+/*
+ * Ends the text and adds its counts to (ctx). Returns the same codes as
+ * freq_feed().
+ */
+int freq_end(FreqContext *ctx);
+
+/*
+ * Limits how much (ctx) counts from now on, to (seconds) of time or (bytes) of
+ * text, whichever runs out first; 0 is no limit. Once the budget has run out,
+ * freq_feed() ignores what it is given, so the texts stop at the end of the
+ * last block that was counted, and the file readers stop reading. The counts
+ * are still those of a whole text for each text that was begun, since each
+ * text is weighed by how many matches were found in it.
+ */
+void freq_set_budget(FreqContext *ctx, double seconds, unsigned long long bytes);
+
+/*
+ * Puts into (coverage) how much of each text that (ctx) has been given, in
+ * order, was counted: an array of (length) entries that belongs to (ctx). A
+ * file that the budget left out altogether has an entry with (scanned) 0.
+ * Returns the scale by which to multiply the counts to estimate what they
+ * would have been had every text been counted: the total multiplier of the
+ * texts over that of the texts that were counted at all.
+ */
+double freq_coverage(const FreqContext *ctx, const FreqCoverage **coverage,
+		size_t *length);
+
+/*
+ * Calls (f) with each sequence that (ctx) has counted, its count and (arg),
+ * from the most to the least frequent. If (f) returns a nonzero value, this
+ * function stops and returns that value. Returns -1 if out of memory.
+ */
+int freq_foreach(const FreqContext *ctx,
+		int (*f)(const char *key, double value, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,2797 @@
+/* 
+ * libfrequency.c
+ * 
+ * The counting engine behind the frequency program, built on its own as 
+ * libfrequency.a. frequency.h is its public interface; the frequency program 
+ * includes this file and adds the command line.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <regex.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frequency.h"
+#include "FreqPatterns.h"
+#include "FreqHash.c"
+#include "FreqRegex.c"
+#include "FreqClass.c"
+#include "FreqDense.c"
+#include "FreqBackend.c"
+#include "FreqPlan.c"
+#include "FreqWords.c"
+#include "FreqCorpus.c"
+#include "FreqNorm.c"
+#include "FreqPool.c"
+#include "FreqRead.c"
+#include "FreqPipe.c"
+#include "FreqDir.c"
+#include "FreqSnap.c"
+#include "FreqDiff.c"
+#include "FreqWindow.c"
+#include "FreqDedup.c"
+
+#define MAX_WORD_LEN 1000
+
+#define CASE_SENSITIVE_P true
+#define CTRL_TO_ESCAPE_P true
+
+/* Keep a normalized copy of each text file next to it; see FreqNorm.c. This 
+ * writes into the directories of the texts, so it is off unless asked for.
+ */
+#define USE_NORM_CACHE_P false
+
+/* Have freq_read_files() read ahead of the scan instead; see FreqRead.c. */
+#define USE_READ_AHEAD_P false
+
+#define MAX_TOKENS_TO_PRINT 0
+
+/* How much freq_read_fd() reads at a time. */
+#define FREQ_BLOCK_SIZE (1 << 20)
+
+/* What a partial scan puts in (next) when it has stopped for good. */
+#define FREQ_SCAN_DONE UINT64_MAX
+
+/* Threads that freq_read_files() counts with. */
+#define FREQ_THREADS 1
+
+/* freq_read_dirs() gives each task files until it has this many, or this many 
+ * bytes, so that a task is not spent on one small file.
+ */
+#define FREQ_BATCH_FILES 256
+#define FREQ_BATCH_BYTES (4 << 20)
+
+/* How many times freq_read_shards() starts a worker again after it fails. */
+#define FREQ_SHARD_RETRIES 2
+
+/* How often freq_read_checkpointed() saves its counts, in seconds. */
+#define FREQ_CHECKPOINT_SECONDS 60
+
+/* Where freq_read_shards() keeps the snapshot of shard %d of %d. */
+#define FREQ_SHARD_FILE "%s/shard-%d-of-%d.snap"
+
+/* 
+ * Everything that one counting job needs: its configuration, the pattern it 
+ * compiled last, and the hash it counts into. The macros above are only the 
+ * defaults. Jobs with separate contexts share nothing, so they can run at the 
+ * same time; see freq_run_jobs().
+ */
+struct FreqContext {
+	bool case_sensitive;
+	bool ctrl_to_escape;
+	bool use_norm_cache;
+	bool read_ahead;
+	size_t max_tokens_to_print; /* 0 for no limit */
+	uint64_t max_word_len;
+	int nthreads;
+	uint64_t checkpoint_seconds;
+	
+	/* The files that freq_read_files() and find_n_words() read, and how much 
+	 * each one counts. There are none by default.
+	 */
+	const char **files;
+	const int *multipliers;
+	size_t nfiles;
+	const char **word_files;
+	const int *word_multipliers;
+	size_t nword_files;
+	
+	Hash hash; /* the counts */
+	
+	/* The last pattern that freq_read_file() compiled, kept for the next file. */
+	char *regex;
+	Plan plan;
+	void *state;
+	
+	/* The input between freq_begin() and freq_end(). Matches are counted once 
+	 * each into (stream) and weighted when the input ends, since the weight 
+	 * depends on how many there are. (pending) holds the bytes from the first 
+	 * window that has not all arrived.
+	 */
+	bool streaming;
+	bool stream_done; /* the scan stopped for good; the rest is ignored */
+	bool stream_nul_seen; /* filter_chars() stops at the first NUL */
+	int stream_multiplier;
+	uint64_t stream_matches;
+	Hash stream;
+	char *pending;
+	uint64_t pending_length, pending_capacity;
+	
+	/* The limit from freq_set_budget(), and how much of each text was fed. */
+	uint64_t budget_ns, budget_bytes; /* 0 for no limit */
+	uint64_t budget_start, budget_used;
+	bool budget_spent;
+	FreqCoverage *coverage;
+	size_t ncoverage, coverage_capacity;
+	
+	/* The documents that find_n_words_for_file() counts when (doc_delimiter) 
+	 * is set: a file is split into documents at each copy of the delimiter, 
+	 * and every file starts a new one. (docs) gets the number of documents 
+	 * that each n-gram starts in, unweighted. Each document gets the next 
+	 * (ndocs) as its number, and an n-gram's entry in (docs) is stamped with 
+	 * it, so that the n-gram counts once per document without a set of the 
+	 * n-grams of each one.
+	 */
+	const char *doc_delimiter; /* NULL to count no documents */
+	Hash docs;
+	uint64_t ndocs; /* documents so far, including empty ones */
+	
+	/* The texts and blocks seen so far, so that freq_read_files(), 
+	 * find_n_words(), freq_read_checkpointed() and freq_read_dirs() count each 
+	 * one once; see FreqDedup.c. Copies of a context share it. The files of 
+	 * a job are all looked at before any of them is counted, so the copy that 
+	 * is kept is the first in order, however many threads count them.
+	 */
+	Dedup *dedup; /* NULL to count every text in full; owned by the caller */
+};
+
+/* The state that the stages of freq_read_files_pipeline() share. */
+typedef struct {
+	FreqContext *ctx;
+	FreqContext scan; /* what the scan stage counts each file with */
+	const char *regex;
+	PipeQueue empty, read, folded, counted;
+	PipeStats stats[4];
+	int error; /* only the add stage sets this */
+	bool stop; /* set if a stage could not start; the read stage ends early */
+} FreqPipeline;
+
+/* The counts of one file, from the scan stage to the add stage. */
+typedef struct {
+	Hash hash;
+	size_t file;
+	int error;
+} FreqPipeResult;
+
+void * freq_pipe_read(void *arg);
+void * freq_pipe_fold(void *arg);
+void * freq_pipe_scan(void *arg);
+void freq_pipe_add(FreqPipeline *pipe);
+
+/* The files that one task of freq_read_dirs() counts, into a context of its own. */
+typedef struct {
+	FreqContext ctx;
+	const DirFile *files;
+	size_t nfiles;
+	const char *regex;
+	int result;
+} FreqBatch;
+
+/* Where freq_read_checkpointed() has got to, and when it last saved. */
+typedef struct {
+	const char *file; /* the checkpoint */
+	uint64_t job;
+	uint64_t index; /* of the text being counted */
+	uint64_t last; /* pipe_clock() when the last checkpoint was written */
+} FreqCheckpoint;
+
+/* One file to count, for freq_run_jobs(). */
+typedef struct {
+	FreqContext *ctx;
+	const char *filename;
+	const char *regex; /* NULL to count n-grams of (wordcount) words instead */
+	int wordcount;
+	int multiplier;
+	int result; /* what freq_read_file() or find_n_words_for_file() returned */
+} FreqJob;
+
+/* 
+ * Sets up (ctx) with the default configuration and an empty hash. (ctx) must 
+ * be freed with freq_context_free().
+ */
+int freq_context_init(FreqContext *ctx);
+
+/* 
+ * Sets up (ctx) with the configuration of (config) and an empty hash.
+ */
+int freq_context_copy(FreqContext *ctx, const FreqContext *config);
+
+void freq_context_free(FreqContext *ctx);
+
+/* 
+ * Compiles (regex) into (ctx), unless it is what (ctx) compiled last. Returns 
+ * -2 if (regex) is invalid.
+ */
+int freq_context_compile(FreqContext *ctx, const char *regex);
+
+/* 
+ * Runs the (njobs) jobs in (jobs) on (nthreads) threads and waits for all of 
+ * them. No two jobs may share a context. Returns the first nonzero result, or 0.
+ */
+int freq_run_jobs(FreqJob *jobs, size_t njobs, int nthreads);
+void freq_job_run(void *job);
+
+/* 
+ * Reads a number of files and calculates the aggregate frequency. If 
+ * ctx->nthreads is more than 1, the files are counted at the same time, each 
+ * in a context of its own, and added into (ctx) in order, with their coverage. 
+ * Otherwise, if ctx->read_ahead is set, they are counted by 
+ * freq_read_files_ahead(), unless ctx->dedup is set, since the parts of a file 
+ * to skip are found in the whole of it. A budget is always spent on one 
+ * thread, so that the files it covers are the first ones in order.
+ */
+int freq_read_files(FreqContext *ctx, const char *regex);
+
+/* 
+ * Counts the files in ctx->files one after another, as freq_feed() blocks, 
+ * while the blocks after them are read in the background. The norm cache is 
+ * not used. A file that is not a regular file, such as /dev/stdin, cannot be 
+ * read ahead, and is read to its end as freq_read_fd() reads it instead.
+ */
+int freq_read_files_ahead(FreqContext *ctx, const char *regex);
+
+/* 
+ * Counts every file under the (ndirs) directories in (dirs), each with the 
+ * weight that FreqDir.c finds for it instead of ctx->multipliers. The trees 
+ * are walked and the files counted on ctx->nthreads threads, in batches of 
+ * small files that share a read buffer and a context, and the batches are 
+ * added into (ctx) in order of path. Returns the codes of freq_read_fd(), or 
+ * -1 if (ctx) has a budget, since the batches could not share it.
+ */
+int freq_read_dirs(FreqContext *ctx, const char **dirs, size_t ndirs, const char *regex);
+void freq_batch_run(void *arg);
+
+/* 
+ * Notes in ctx->dedup, in order, which parts of each of the (nfiles) files in 
+ * (files) are copies of what came before, unless it already knows the file. 
+ * Returns the codes of read_normalized().
+ */
+int freq_dedup_files(FreqContext *ctx, const char **files, size_t nfiles);
+
+/* 
+ * Drops from the (nfiles) files in (files) each one that is a copy of a file 
+ * before it, and notes the bytes it drops in ctx->dedup. Only the files whose 
+ * size another one shares are read. Their blocks are not looked at, since 
+ * freq_read_dirs() counts the files as they stream in rather than whole. 
+ * Returns the codes of read_normalized().
+ */
+int freq_dedup_dir(FreqContext *ctx, DirFile *files, size_t *nfiles);
+int freq_dir_file_size_comparator(const void *x, const void *y);
+
+/* 
+ * Counts the parts of (buffer) that (kept) names into (hash), once each, 
+ * with the pattern compiled in (ctx). Returns the number of matches, or the 
+ * codes of freq_scan_plan().
+ */
+int freq_scan_kept(const FreqContext *ctx, Hash *hash, char *buffer, 
+		const uint64_t *legal, const DedupKept *kept);
+
+/* 
+ * Counts the files under (dirs) as freq_read_dirs() does, but in (nshards) 
+ * worker processes, so that a worker that runs out of memory or crashes takes 
+ * only its own shard with it. The files are split by size into runs of 
+ * neighbouring paths, and each worker writes the counts of its run to a 
+ * snapshot in (snap_dir); see FreqSnap.c. A worker that fails is started 
+ * again, up to FREQ_SHARD_RETRIES times, and a shard whose snapshot is already 
+ * in (snap_dir) from an earlier run of the same job is not counted again. The 
+ * snapshots are then added into (ctx) in order.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: A shard failed every time, a snapshot could not be read, out of 
+ *     memory, or (ctx) has a budget, which the shards could not share.
+ */
+int freq_read_shards(FreqContext *ctx, const char **dirs, size_t ndirs, 
+		const char *regex, int nshards, const char *snap_dir);
+
+/* 
+ * Starts a worker process that counts the (nfiles) files in (files) and 
+ * writes them to (snap_file). Returns its pid, or -1 if it could not start.
+ */
+pid_t freq_shard_start(FreqContext *ctx, const DirFile *files, size_t nfiles, 
+		const char *regex, const char *snap_file, uint64_t job);
+
+/* 
+ * Returns a number that differs between two shard jobs that would count 
+ * differently, to mark their snapshots with.
+ */
+uint64_t freq_shard_job(const FreqContext *ctx, const DirFile *files, size_t nfiles, 
+		const char *regex, int nshards);
+
+/* 
+ * Reads (fd) to its end into (block), which holds FREQ_BLOCK_SIZE bytes, and 
+ * feeds it to the text that is open in (ctx).
+ */
+int freq_feed_fd(FreqContext *ctx, int fd, char *block);
+
+/* 
+ * Counts the files in ctx->files the way freq_read_files_ahead() does, as a 
+ * pipeline of four stages, each on a thread of its own: read the files into 
+ * chunks, fold the chunks, scan them, and add each file's counts into (ctx) in 
+ * order. The stages pass the chunks along in FreqPipe queues and hand them 
+ * back to be read into again, so there are never more than PIPE_CHUNKS. If 
+ * (report) is not NULL, how busy each stage was is printed to it. Returns -1 
+ * if a file could not be read, a stage could not be started, or out of memory.
+ */
+int freq_read_files_pipeline(FreqContext *ctx, const char *regex, FILE *report);
+
+/* 
+ * Find all sequences of (wordcount) words. This does not work as a regex, so 
+ * it has its own function.
+ */
+int find_n_words(FreqContext *ctx, int wordcount);
+int find_n_words_for_file(FreqContext *ctx, const char *filename, int wordcount, int multiplier);
+
+/* 
+ * Does the same as find_n_words_for_file(), starting from the n-gram at 
+ * (start). If (cp) is not NULL, a checkpoint is written whenever 
+ * ctx->checkpoint_seconds have passed since the last one.
+ */
+int find_n_words_from(FreqContext *ctx, const char *filename, int wordcount, 
+		int multiplier, uint64_t start, FreqCheckpoint *cp);
+
+/* 
+ * Counts the n-grams of (wordcount) words in (filename) in windows of (size) 
+ * units of (unit) that start every (step) units (see FreqWindow.c), and calls 
+ * (f) with the number of each window, its counts and (arg), in order. An 
+ * n-gram is in the windows that hold the unit its first word starts in. 
+ * Documents are split at ctx->doc_delimiter. The text is read once: when the 
+ * windows overlap, the counts are kept from one window to the next, and the 
+ * n-grams that fall behind the next window are taken out of them again. If 
+ * (f) returns a nonzero value, this function stops and returns that value.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: File read error, or out of memory.
+ */
+int find_n_words_windowed(FreqContext *ctx, const char *filename, int wordcount, 
+		WindowUnit unit, uint64_t size, uint64_t step, 
+		int (*f)(uint64_t window, Hash counts, void *arg), void *arg);
+
+/* 
+ * Returns the number of n-grams of (wordcount) words in (words), which were 
+ * found in a text of (length) bytes.
+ */
+size_t freq_ngram_count(const WordList *words, uint64_t length, int wordcount);
+
+/* 
+ * Puts n-gram (t) of (wordcount) words of (buffer) into (key), which has room 
+ * for (capacity) bytes and is made bigger if it needs to be. Returns the length 
+ * of the n-gram, or -1 if out of memory.
+ */
+long freq_ngram_key(char **key, size_t *capacity, const char *buffer, 
+		const WordList *words, size_t t, int wordcount);
+
+/* 
+ * Adds the n-grams of (wordcount) words of the (length) bytes of (region), 
+ * times (value), to (delta), and folds (region) first as freq_fold() does, 
+ * with (nul_seen) set if a NUL comes before it in the text. If (at_end) is not 
+ * set, the text goes on after the region, and only the n-grams that end 
+ * within it are counted. Returns -1 if out of memory.
+ */
+int freq_edit_count(Hash *delta, char *region, uint64_t length, bool at_end, 
+		int wordcount, double value, bool case_sensitive, bool nul_seen);
+
+/* 
+ * Returns where the text around an edit must start so that every n-gram of 
+ * (wordcount) words that the edit at (at) can change is in it, and the first 
+ * word in it is whole. freq_edit_right() does the same for the end of the 
+ * text around an edit that ends at (at).
+ */
+uint64_t freq_edit_left(const char *text, uint64_t at, int wordcount);
+uint64_t freq_edit_right(const char *text, uint64_t length, uint64_t at, int wordcount);
+
+/* 
+ * Returns whether (c) can be part of a word for words_tokenize().
+ */
+bool freq_word_byte(char c);
+
+/* 
+ * Counts (regex) in ctx->files as freq_read_files() does or, if (regex) is 
+ * NULL, the n-grams of (wordcount) words in ctx->word_files as find_n_words() 
+ * does, and saves the counts so far to (checkpoint_file) every 
+ * ctx->checkpoint_seconds and at the end. A pattern is saved after each file, 
+ * and n-grams also within a file. If (resume) is set and (checkpoint_file) 
+ * holds a checkpoint of the same job, the counts start from it instead of 
+ * from nothing. Only ctx->hash is saved, not ctx->docs.
+ *
+ * Return Codes
+ * -0: Success.
+ * -1: A file or the checkpoint could not be read or written, or out of 
+ *     memory.
+ * -2: Invalid regular expression.
+ */
+int freq_read_checkpointed(FreqContext *ctx, const char *regex, int wordcount, 
+		const char *checkpoint_file, bool resume);
+
+/* 
+ * Writes the counts in (ctx) to the checkpoint (cp), as going up to (offset) 
+ * in the text at (index).
+ */
+int freq_checkpoint(FreqContext *ctx, FreqCheckpoint *cp, uint64_t index, uint64_t offset);
+
+/* 
+ * Returns a number that differs between two checkpointed jobs that would 
+ * count differently, including when one of their files has changed.
+ */
+uint64_t freq_checkpoint_job(const FreqContext *ctx, const char *regex, int wordcount);
+
+/* 
+ * Does the same as find_n_words_for_file() for a corpus that 
+ * freq_tokenize_file() wrote, without reading or tokenizing the text.
+ */
+int find_n_words_for_corpus(FreqContext *ctx, const char *ids_file, const char *vocab_file, 
+		int wordcount, int multiplier);
+
+/* 
+ * Tokenizes the text in (filename) once and writes it as a corpus of word IDs 
+ * to (ids_file) and (vocab_file). See FreqCorpus.c for the format.
+ */
+int freq_tokenize_file(const FreqContext *ctx, const char *filename, const char *ids_file, 
+		const char *vocab_file);
+
+/* Increase the value of (sequence) in the hash function (hash).
+ */
+int freq_hash_inc(Hash *hash, char *sequence, double value, regmatch_t matchptr[]);
+
+/* Apply a filter to every char in (buffer). */
+int filter_chars(char *buffer);
+
+/* Scan a buffer and add regex matches to the hash, using (backend) to run the 
+ * pattern that it compiled into (state). If (prefilter) is not NULL, it must 
+ * hold every byte that can begin a match, plus NUL; the scan jumps from one 
+ * such byte to the next instead of calling the backend in between.
+ */
+int freq_scan(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const RegexBackend *backend, 
+		void *state, bool overlap, const ByteClass *prefilter, double adjusted_multiplier, 
+		uint64_t *next);
+
+/* Scan a buffer for every overlapping run of (n) bytes from (set), in one pass. 
+ * This finds the same matches as freq_scan() does for a fixed-length class 
+ * n-gram such as FREQ_LETTER_TRIGRAPHS, without calling regexec() at every 
+ * position. The buffer is classified 64 bytes at a time into a bitmask of 
+ * members, and the n-grams are counted in a DenseTable when the set is small 
+ * enough to allow one.
+ */
+int freq_scan_class(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const ByteSet *set, 
+		int n, const uint64_t *legal, double adjusted_multiplier, uint64_t *next);
+
+/* Scan a buffer for a positional pattern (see regex_positional()), which 
+ * matches each run of bytes from its class, cut short by the same MAX_WORD_LEN 
+ * window that freq_scan() uses.
+ */
+int freq_scan_runs(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const Plan *plan, 
+		double adjusted_multiplier, uint64_t *next);
+
+/* Scan a buffer with the engine that (plan) chose. (state) is the pattern as 
+ * compiled by plan->backend. (legal) is the buffer's legality bitmap from a 
+ * NormText, or NULL.
+ * 
+ * Every scanner returns the number of matches, or -4 if the backend ran out 
+ * of memory. If (next) is NULL, the buffer is the whole text. Otherwise more of 
+ * the text is still to come: the scan stops before the first MAX_WORD_LEN 
+ * window that runs past the end of the buffer and puts where that window 
+ * starts into (next), so that the scan can go on from there once the rest of 
+ * the window has arrived. If the scan stopped for good first, (next) is set to 
+ * FREQ_SCAN_DONE.
+ */
+int freq_scan_plan(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const Plan *plan, 
+		void *state, const uint64_t *legal, double adjusted_multiplier, uint64_t *next);
+
+/* Does the same as freq_scan_class() one byte at a time. This is used when the 
+ * buffer contains a NUL, which ends the regexec() window early, or when (n) is 
+ * too long for the bitmasks.
+ */
+int freq_scan_class_runs(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const ByteSet *set, 
+		int n, double adjusted_multiplier, uint64_t *next);
+
+/* 
+ * Folds (length) bytes of (src) into (dest) as read_file() and filter_chars() 
+ * would. (nul_seen) says whether a NUL has come before (src) in the text, and 
+ * is updated.
+ */
+void freq_fold(char *dest, const char *src, size_t length, bool case_sensitive, 
+		bool *nul_seen);
+
+/* 
+ * Appends (length) bytes of (bytes) to ctx->pending, folding them unless 
+ * (folded) says that they already are, and scans what it can.
+ */
+int freq_stream_feed(FreqContext *ctx, const char *bytes, size_t length, bool folded);
+
+/* 
+ * Returns whether the budget of (ctx) has run out, and notes it if it just has.
+ */
+bool freq_budget_spent(FreqContext *ctx);
+
+/* 
+ * Adds an entry for a text to the coverage of (ctx), and returns it, or NULL 
+ * if out of memory.
+ */
+FreqCoverage * freq_cover(FreqContext *ctx, const char *name, int multiplier);
+
+/* 
+ * Names the last text in the coverage of (ctx) as the file (filename), and 
+ * notes its size.
+ */
+void freq_cover_file(FreqContext *ctx, const char *filename);
+
+/* 
+ * Counts the (length) bytes of (text), which is already folded and is the 
+ * file (filename), the way freq_read_fd() counts its input, so that it stops 
+ * at the end of the block that spends the budget of (ctx). If (kept) is not 
+ * NULL, only its parts are fed, and each is scanned to its end on its own, as 
+ * freq_scan_kept() does.
+ */
+int freq_feed_text(FreqContext *ctx, const char *filename, const char *regex, 
+		int multiplier, const char *text, uint64_t length, const DedupKept *kept);
+
+/* 
+ * Scans ctx->pending and drops the bytes that no later match can need. If 
+ * (final) is set, there is no more text and the whole of it is scanned.
+ */
+int freq_stream_scan(FreqContext *ctx, bool final);
+
+bool legal_chars(const char *sequence, size_t length);
+
+int read_file(char **buffer, uint64_t *length, const char *filename, bool case_sensitive);
+
+/* 
+ * Puts the text of (filename), after read_file() and filter_chars(), into 
+ * (norm). If ctx->use_norm_cache is set, the text is mapped from the file's 
+ * cache when the cache is fresh, and the cache is rebuilt when it is not. 
+ * (norm) must be freed with norm_close().
+ */
+int read_normalized(const FreqContext *ctx, NormText *norm, const char *filename);
+
+int freq_context_init(FreqContext *ctx)
+{
+	ctx->case_sensitive = CASE_SENSITIVE_P;
+	ctx->ctrl_to_escape = CTRL_TO_ESCAPE_P;
+	ctx->use_norm_cache = USE_NORM_CACHE_P;
+	ctx->read_ahead = USE_READ_AHEAD_P;
+	ctx->max_tokens_to_print = MAX_TOKENS_TO_PRINT;
+	ctx->max_word_len = MAX_WORD_LEN;
+	ctx->nthreads = FREQ_THREADS;
+	ctx->checkpoint_seconds = FREQ_CHECKPOINT_SECONDS;
+	
+	ctx->files = NULL;
+	ctx->multipliers = NULL;
+	ctx->nfiles = 0;
+	ctx->word_files = NULL;
+	ctx->word_multipliers = NULL;
+	ctx->nword_files = 0;
+	
+	ctx->regex = NULL;
+	ctx->state = NULL;
+	ctx->streaming = false;
+	ctx->pending = NULL;
+	ctx->pending_length = ctx->pending_capacity = 0;
+	
+	ctx->budget_ns = ctx->budget_bytes = 0;
+	ctx->budget_start = ctx->budget_used = 0;
+	ctx->budget_spent = false;
+	ctx->coverage = NULL;
+	ctx->ncoverage = ctx->coverage_capacity = 0;
+	
+	ctx->doc_delimiter = NULL;
+	ctx->ndocs = 0;
+	hash_init(&ctx->docs);
+	ctx->dedup = NULL;
+	return hash_init(&ctx->hash);
+}
+
+int freq_context_copy(FreqContext *ctx, const FreqContext *config)
+{
+	*ctx = *config;
+	ctx->regex = NULL;
+	ctx->state = NULL;
+	ctx->streaming = false;
+	ctx->pending = NULL;
+	ctx->pending_length = ctx->pending_capacity = 0;
+	ctx->coverage = NULL;
+	ctx->ncoverage = ctx->coverage_capacity = 0;
+	ctx->ndocs = 0;
+	hash_init(&ctx->docs);
+	return hash_init(&ctx->hash);
+}
+
+void freq_context_free(FreqContext *ctx)
+{
+	free(ctx->coverage);
+	ctx->coverage = NULL;
+	ctx->ncoverage = ctx->coverage_capacity = 0;
+	if (ctx->streaming) {
+		hash_clear(&ctx->stream);
+		ctx->streaming = false;
+	}
+	free(ctx->pending);
+	ctx->pending = NULL;
+	ctx->pending_length = ctx->pending_capacity = 0;
+	if (ctx->regex) {
+		ctx->plan.backend->free(ctx->state);
+		free(ctx->regex);
+		ctx->regex = NULL;
+	}
+	hash_clear(&ctx->docs);
+	hash_clear(&ctx->hash);
+}
+
+int freq_context_compile(FreqContext *ctx, const char *regex)
+{
+	if (ctx->regex && strcmp(ctx->regex, regex) == 0)
+		return 0;
+	
+	if (ctx->regex) {
+		ctx->plan.backend->free(ctx->state);
+		free(ctx->regex);
+		ctx->regex = NULL;
+	}
+	
+	/* For fixed-length sequences, look for overlaps. For variable-length 
+	 * sequences, do not. The plan decides which is which, and how to scan.
+	 */
+	plan_pattern(&ctx->plan, regex);
+	if (ctx->plan.backend->compile(&ctx->state, regex))
+		return -2;
+	
+	ctx->regex = malloc(strlen(regex) + 1);
+	if (ctx->regex == NULL) {
+		ctx->plan.backend->free(ctx->state);
+		return -2;
+	}
+	strcpy(ctx->regex, regex);
+	return 0;
+}
+
+int freq_run_jobs(FreqJob *jobs, size_t njobs, int nthreads)
+{
+	FreqPool pool;
+	size_t i;
+	
+	if (pool_init(&pool, nthreads))
+		return -1;
+	
+	for (i = 0; i < njobs; ++i) {
+		if (pool_submit(&pool, freq_job_run, &jobs[i])) {
+			jobs[i].result = -1;
+			break;
+		}
+	}
+	pool_free(&pool);
+	
+	for (i = 0; i < njobs; ++i)
+		if (jobs[i].result)
+			return jobs[i].result;
+	return 0;
+}
+
+void freq_job_run(void *arg)
+{
+	FreqJob *job = arg;
+	if (job->regex)
+		job->result = freq_read_file(job->ctx, job->filename, job->regex, job->multiplier);
+	else
+		job->result = find_n_words_for_file(job->ctx, job->filename, job->wordcount, 
+				job->multiplier);
+}
+
+/* 
+ * Reads the array `ctx->files` and calls `freq_read_file()` on each
+ * file in the array.
+ */
+int freq_read_files(FreqContext *ctx, const char *regex)
+{
+	int ret = 0;
+	size_t i;
+	
+	if (ctx->dedup && (ret = freq_dedup_files(ctx, ctx->files, ctx->nfiles)))
+		return ret;
+	
+	bool budget = ctx->budget_ns || ctx->budget_bytes;
+	if (!ctx->dedup && (budget || (ctx->nthreads <= 1 && ctx->read_ahead)))
+		return freq_read_files_ahead(ctx, regex);
+	
+	if (ctx->nthreads <= 1 || budget) {
+		for (i = 0; i < ctx->nfiles; ++i) {
+			ret = freq_read_file(ctx, ctx->files[i], regex, ctx->multipliers[i]);
+			if (ret) return ret;
+			printf("done with %s at %d\n", ctx->files[i], ctx->multipliers[i]);
+		}
+		return ret;
+	}
+	
+	FreqContext *children = malloc(sizeof(FreqContext) * ctx->nfiles);
+	FreqJob *jobs = malloc(sizeof(FreqJob) * ctx->nfiles);
+	if (children == NULL || jobs == NULL) {
+		free(children);
+		free(jobs);
+		return -1;
+	}
+	
+	for (i = 0; i < ctx->nfiles; ++i) {
+		if (freq_context_copy(&children[i], ctx)) {
+			while (i-- > 0)
+				freq_context_free(&children[i]);
+			free(children);
+			free(jobs);
+			return -1;
+		}
+		jobs[i].ctx = &children[i];
+		jobs[i].filename = ctx->files[i];
+		jobs[i].regex = regex;
+		jobs[i].wordcount = 0;
+		jobs[i].multiplier = ctx->multipliers[i];
+		jobs[i].result = 0;
+	}
+	
+	ret = freq_run_jobs(jobs, ctx->nfiles, ctx->nthreads);
+	
+	/* Add the files up in order, so the result does not depend on which 
+	 * thread finished first.
+	 */
+	for (i = 0; i < ctx->nfiles; ++i) {
+		size_t k;
+		for (k = 0; k < children[i].ncoverage && ret == 0; ++k) {
+			FreqCoverage *cover = freq_cover(ctx, NULL, 0);
+			if (cover == NULL) ret = -1;
+			else *cover = children[i].coverage[k];
+		}
+		if (ret == 0) {
+			hash_merge(&ctx->hash, children[i].hash, 1);
+			printf("done with %s at %d\n", ctx->files[i], ctx->multipliers[i]);
+		}
+		freq_context_free(&children[i]);
+	}
+	
+	free(children);
+	free(jobs);
+	return ret;
+}
+
+int freq_read_files_ahead(FreqContext *ctx, const char *regex)
+{
+	ReadAhead ra;
+	ReadBlock *block;
+	char *stream_block = NULL;
+	int ret = readahead_init(&ra, ctx->files, ctx->nfiles);
+	if (ret) return ret;
+	
+	size_t file = 0;
+	while (ret == 0 && (block = readahead_next(&ra)) != NULL) {
+		ret = block->error;
+		if (ret == 0 && block->first) {
+			ret = freq_begin(ctx, regex, ctx->multipliers[block->file]);
+			if (ret == 0)
+				freq_cover_file(ctx, ctx->files[file++]);
+		}
+		if (ret == 0 && block->stream_fd >= 0) {
+			if (stream_block == NULL && 
+					(stream_block = malloc(FREQ_BLOCK_SIZE)) == NULL)
+				ret = -1;
+			else
+				ret = freq_feed_fd(ctx, block->stream_fd, stream_block);
+			
+			/* A stream has no size until it has been read to its end. */
+			FreqCoverage *cover = &ctx->coverage[ctx->ncoverage - 1];
+			if (ret == 0 && !ctx->budget_spent)
+				cover->size = cover->scanned;
+		} else if (ret == 0) {
+			ret = freq_feed(ctx, block->data, block->length);
+		}
+		if (ret == 0 && block->last) {
+			ret = freq_end(ctx);
+			if (ret == 0)
+				printf("done with %s at %d\n", ctx->files[block->file], 
+						ctx->multipliers[block->file]);
+		}
+		readahead_release(&ra, block);
+		
+		/* Stop at the end of the block that used up the budget. */
+		if (ret == 0 && ctx->budget_spent)
+			break;
+	}
+	
+	if (ret == 0 && ra.failed)
+		ret = -1;
+	
+	/* End a file that was cut short by an error or the budget. */
+	if (ctx->streaming) {
+		int end = freq_end(ctx);
+		if (ret == 0) ret = end;
+		if (ret == 0 && ctx->budget_spent)
+			printf("ran out of budget in %s\n", ctx->files[file - 1]);
+	}
+	
+	/* Note the files that the budget left out. */
+	for (; ret == 0 && file < ctx->nfiles; ++file) {
+		if (freq_cover(ctx, ctx->files[file], ctx->multipliers[file]) == NULL)
+			ret = -1;
+		else
+			freq_cover_file(ctx, ctx->files[file]);
+	}
+	
+	free(stream_block);
+	readahead_free(&ra);
+	return ret;
+}
+
+/* Passed down the pipeline after the last chunk. */
+static PipeChunk pipe_end_chunk;
+static FreqPipeResult pipe_end_result;
+
+/* Passed on by the scan stage for a file whose result it could not allocate. */
+static FreqPipeResult pipe_nomem_result;
+
+int freq_read_files_pipeline(FreqContext *ctx, const char *regex, FILE *report)
+{
+	static const char *names[] = { "read", "fold", "scan", "add" };
+	static void * (*const stages[])(void *) = { 
+		freq_pipe_read, freq_pipe_fold, freq_pipe_scan 
+	};
+	FreqPipeline pipe;
+	PipeChunk chunks[PIPE_CHUNKS];
+	pthread_t threads[3];
+	size_t i;
+	int ret = 0;
+	
+	memset(&pipe, 0, sizeof(FreqPipeline));
+	pipe.ctx = ctx;
+	pipe.regex = regex;
+	for (i = 0; i < 4; ++i)
+		pipe.stats[i].name = names[i];
+	
+	/* Every queue has room for every chunk and the end marker, so a push only 
+	 * waits when the chunks have run out.
+	 */
+	if (freq_context_copy(&pipe.scan, ctx)) return -1;
+	if (pipe_queue_init(&pipe.empty, PIPE_CHUNKS * 2) || 
+			pipe_queue_init(&pipe.read, PIPE_CHUNKS * 2) || 
+			pipe_queue_init(&pipe.folded, PIPE_CHUNKS * 2) || 
+			pipe_queue_init(&pipe.counted, PIPE_CHUNKS * 2))
+		ret = -1;
+	
+	for (i = 0; i < PIPE_CHUNKS; ++i) {
+		chunks[i].data = ret ? NULL : malloc(PIPE_CHUNK_SIZE);
+		if (chunks[i].data == NULL) ret = -1;
+		else pipe_push(&pipe.empty, &chunks[i]);
+	}
+	
+	uint64_t start = pipe_clock();
+	if (ret == 0) {
+		size_t started;
+		for (started = 0; started < 3; ++started)
+			if (pthread_create(&threads[started], NULL, stages[started], &pipe))
+				break;
+		
+		if (started == 3) {
+			freq_pipe_add(&pipe);
+			ret = pipe.error;
+		} else {
+			/* Stop the read stage, and hand the chunks that come out of the 
+			 * last stage that started back to it until its end marker does.
+			 */
+			__atomic_store_n(&pipe.stop, true, __ATOMIC_RELAXED);
+			if (started > 0) {
+				PipeQueue *out = started == 1 ? &pipe.read : &pipe.folded;
+				PipeChunk *chunk;
+				while ((chunk = pipe_pop(out)) != &pipe_end_chunk)
+					pipe_push(&pipe.empty, chunk);
+			}
+			ret = -1;
+		}
+		for (i = 0; i < started; ++i)
+			pthread_join(threads[i], NULL);
+	}
+	
+	if (report && ret == 0)
+		pipe_report(report, pipe.stats, 4, pipe_clock() - start);
+	
+	for (i = 0; i < PIPE_CHUNKS; ++i)
+		free(chunks[i].data);
+	pipe_queue_free(&pipe.empty);
+	pipe_queue_free(&pipe.read);
+	pipe_queue_free(&pipe.folded);
+	pipe_queue_free(&pipe.counted);
+	freq_context_free(&pipe.scan);
+	return ret;
+}
+
+void * freq_pipe_read(void *arg)
+{
+	FreqPipeline *pipe = arg;
+	PipeStats *stats = &pipe->stats[0];
+	size_t file;
+	
+	for (file = 0; file < pipe->ctx->nfiles; ++file) {
+		if (__atomic_load_n(&pipe->stop, __ATOMIC_RELAXED))
+			break;
+		int fd = open(pipe->ctx->files[file], O_RDONLY);
+		bool first = true, eof = false;
+		
+		while (!eof && !__atomic_load_n(&pipe->stop, __ATOMIC_RELAXED)) {
+			PipeChunk *chunk = pipe_pop(&pipe->empty);
+			uint64_t start = pipe_clock();
+			
+			chunk->file = file;
+			chunk->first = first;
+			chunk->length = 0;
+			chunk->error = fd < 0 ? -1 : 0;
+			eof = fd < 0;
+			while (!eof && chunk->length < PIPE_CHUNK_SIZE) {
+				ssize_t got = read(fd, chunk->data + chunk->length, 
+						PIPE_CHUNK_SIZE - chunk->length);
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got < 0)
+					chunk->error = -1;
+				if (got <= 0)
+					eof = true;
+				else
+					chunk->length += got;
+			}
+			chunk->last = eof;
+			first = false;
+			
+			stats->busy_ns += pipe_clock() - start;
+			++stats->items;
+			stats->bytes += chunk->length;
+			pipe_push(&pipe->read, chunk);
+		}
+		
+		if (fd >= 0)
+			close(fd);
+	}
+	
+	pipe_push(&pipe->read, &pipe_end_chunk);
+	return NULL;
+}
+
+void * freq_pipe_fold(void *arg)
+{
+	FreqPipeline *pipe = arg;
+	PipeStats *stats = &pipe->stats[1];
+	PipeChunk *chunk;
+	bool nul_seen = false;
+	
+	while ((chunk = pipe_pop(&pipe->read)) != &pipe_end_chunk) {
+		uint64_t start = pipe_clock();
+		if (chunk->first)
+			nul_seen = false;
+		freq_fold(chunk->data, chunk->data, chunk->length, pipe->ctx->case_sensitive, 
+				&nul_seen);
+		stats->busy_ns += pipe_clock() - start;
+		++stats->items;
+		stats->bytes += chunk->length;
+		pipe_push(&pipe->folded, chunk);
+	}
+	
+	pipe_push(&pipe->folded, &pipe_end_chunk);
+	return NULL;
+}
+
+void * freq_pipe_scan(void *arg)
+{
+	FreqPipeline *pipe = arg;
+	PipeStats *stats = &pipe->stats[2];
+	FreqContext *scan = &pipe->scan;
+	PipeChunk *chunk;
+	int ret = 0;
+	
+	while ((chunk = pipe_pop(&pipe->folded)) != &pipe_end_chunk) {
+		uint64_t start = pipe_clock();
+		
+		if (chunk->first)
+			ret = chunk->error ? chunk->error : 
+					freq_begin(scan, pipe->regex, pipe->ctx->multipliers[chunk->file]);
+		if (ret == 0)
+			ret = chunk->error ? chunk->error : 
+					freq_stream_feed(scan, chunk->data, chunk->length, true);
+		
+		if (chunk->last) {
+			FreqPipeResult *result = malloc(sizeof(FreqPipeResult));
+			if (scan->streaming) {
+				int end = freq_end(scan);
+				if (ret == 0) ret = end;
+			}
+			if (result) {
+				/* Hand the file's counts on and start the next file afresh. */
+				result->hash = scan->hash;
+				result->file = chunk->file;
+				result->error = ret;
+				if (hash_init(&scan->hash)) result->error = -1;
+				pipe_push(&pipe->counted, result);
+			} else {
+				/* Drop the file's counts, and let the add stage fail. */
+				hash_clear(&scan->hash);
+				hash_init(&scan->hash);
+				pipe_push(&pipe->counted, &pipe_nomem_result);
+			}
+			ret = 0;
+		}
+		
+		stats->busy_ns += pipe_clock() - start;
+		++stats->items;
+		stats->bytes += chunk->length;
+		pipe_push(&pipe->empty, chunk);
+	}
+	
+	pipe_push(&pipe->counted, &pipe_end_result);
+	return NULL;
+}
+
+void freq_pipe_add(FreqPipeline *pipe)
+{
+	PipeStats *stats = &pipe->stats[3];
+	FreqPipeResult *result;
+	
+	while ((result = pipe_pop(&pipe->counted)) != &pipe_end_result) {
+		uint64_t start = pipe_clock();
+		if (result == &pipe_nomem_result) {
+			if (pipe->error == 0)
+				pipe->error = -1;
+			continue;
+		}
+		if (result->error == 0 && pipe->error == 0) {
+			hash_merge(&pipe->ctx->hash, result->hash, 1);
+			printf("done with %s at %d\n", pipe->ctx->files[result->file], 
+					pipe->ctx->multipliers[result->file]);
+		} else if (pipe->error == 0) {
+			pipe->error = result->error;
+		}
+		hash_clear(&result->hash);
+		free(result);
+		stats->busy_ns += pipe_clock() - start;
+		++stats->items;
+	}
+}
+
+int filter_chars(char *buffer)
+{
+	size_t i, length = strlen(buffer);
+	for (i = 0; i < length; ++i) {
+		buffer[i] = (char) tolower((int) buffer[i]);
+	}
+	
+	return 0;
+}
+
+int read_normalized(const FreqContext *ctx, NormText *norm, const char *filename)
+{
+	uint32_t flags = ctx->case_sensitive ? NORM_CASE_SENSITIVE : 0;
+	struct stat source;
+	int ret;
+	memset(norm, 0, sizeof(NormText));
+	
+	if (!ctx->use_norm_cache || stat(filename, &source)) {
+		ret = read_file(&norm->text, &norm->length, filename, ctx->case_sensitive);
+		if (ret == 0)
+			filter_chars(norm->text);
+		return ret;
+	}
+	
+	size_t name_length = strlen(filename);
+	char cache_file[name_length + sizeof(NORM_SUFFIX)];
+	memcpy(cache_file, filename, name_length);
+	memcpy(cache_file + name_length, NORM_SUFFIX, sizeof(NORM_SUFFIX));
+	
+	if (norm_open(norm, cache_file, &source, flags) == 0)
+		return 0;
+	
+	ret = read_file(&norm->text, &norm->length, filename, ctx->case_sensitive);
+	if (ret)
+		return ret;
+	filter_chars(norm->text);
+	
+	/* If the cache cannot be written, the text is just read again next time. */
+	norm_write(cache_file, norm->text, norm->length, &source, flags);
+	return 0;
+}
+
+/*
+ * Reads the file at `filename`. Finds all matches for the given
+ * regular expression and counts their frequency, storing the result
+ * in `hash`. The frequencies are multiplied by `multiplier`. Use this
+ * if you want to read multiple files and weight some more heavily
+ * than others.
+ */
+int freq_read_file(FreqContext *ctx, const char *filename, const char *regex, int multiplier)
+{
+	int matches = 0;
+	
+	int ret = freq_context_compile(ctx, regex);
+	if (ret) return ret;
+	
+	/* A file that the budget leaves out is not read at all. */
+	bool budget = ctx->budget_ns || ctx->budget_bytes;
+	if (budget && freq_budget_spent(ctx)) {
+		if (freq_cover(ctx, filename, multiplier) == NULL) return -1;
+		freq_cover_file(ctx, filename);
+		return 0;
+	}
+	 
+	NormText norm;
+	ret = read_normalized(ctx, &norm, filename);
+	if (ret) return ret;
+	char *buffer = norm.text;
+	uint64_t length = norm.length;
+	
+	/* A file that no job has looked at yet is looked at now. */
+	const DedupKept *kept = NULL;
+	if (ctx->dedup && (kept = dedup_find(ctx->dedup, filename)) == NULL) {
+		if (dedup_text(ctx->dedup, filename, buffer, length)) {
+			norm_close(&norm);
+			return -1;
+		}
+		kept = dedup_find(ctx->dedup, filename);
+	}
+	
+	if (budget) {
+		ret = freq_feed_text(ctx, filename, regex, multiplier, buffer, length, kept);
+		norm_close(&norm);
+		return ret;
+	}
+	
+	FreqCoverage *cover = freq_cover(ctx, filename, multiplier);
+	if (cover == NULL) {
+		norm_close(&norm);
+		return -1;
+	}
+	cover->scanned = cover->size = length;
+	if (kept) {
+		size_t k;
+		for (k = 0, cover->scanned = 0; k < kept->length; ++k)
+			cover->scanned += kept->ranges[2*k+1] - kept->ranges[2*k];
+	}
+
+	/* Count each match once, and weigh them all at the end by how many there 
+	 * were, as freq_end() does. Each key of each file is then added to the 
+	 * total once, as one product, in the order of the files, so the total is 
+	 * the same to the last bit however many threads counted the files.
+	 */
+	Hash counts;
+	hash_init(&counts);
+	int count = kept ? freq_scan_kept(ctx, &counts, buffer, norm.legal, kept) : 
+			freq_scan_plan(ctx, &counts, buffer, length, &ctx->plan, ctx->state, 
+			norm.legal, 1, NULL);
+	if (count > 0)
+		hash_merge(&ctx->hash, counts, (double) multiplier / count);
+	else if (count < 0)
+		matches = count;
+	
+	hash_clear(&counts);
+	norm_close(&norm);
+			
+	return matches;
+}
+
+int freq_scan_kept(const FreqContext *ctx, Hash *hash, char *buffer, 
+		const uint64_t *legal, const DedupKept *kept)
+{
+	int count = 0;
+	size_t k;
+	
+	/* Each part ends at a NUL of its own for the scan, as the text does, and 
+	 * the bitmap can only be used for a part that starts on one of its words.
+	 */
+	for (k = 0; k < kept->length; ++k) {
+		uint64_t start = kept->ranges[2*k], end = kept->ranges[2*k+1];
+		char saved = buffer[end];
+		buffer[end] = '\0';
+		int n = freq_scan_plan(ctx, hash, buffer + start, end - start, &ctx->plan, 
+				ctx->state, legal && start % 64 == 0 ? legal + start / 64 : NULL, 1, 
+				NULL);
+		buffer[end] = saved;
+		if (n < 0)
+			return n;
+		count += n;
+	}
+	return count;
+}
+
+int freq_feed_text(FreqContext *ctx, const char *filename, const char *regex, 
+		int multiplier, const char *text, uint64_t length, const DedupKept *kept)
+{
+	size_t k, nparts = kept ? kept->length : 1;
+	
+	int ret = freq_begin(ctx, regex, multiplier);
+	if (ret) return ret;
+	freq_cover_file(ctx, filename);
+	
+	for (k = 0; k < nparts && ret == 0 && !ctx->budget_spent; ++k) {
+		uint64_t at = kept ? kept->ranges[2*k] : 0;
+		uint64_t end = kept ? kept->ranges[2*k+1] : length;
+		for (; at < end && ret == 0 && !freq_budget_spent(ctx); at += FREQ_BLOCK_SIZE)
+			ret = freq_stream_feed(ctx, text + at, 
+					end - at < FREQ_BLOCK_SIZE ? end - at : FREQ_BLOCK_SIZE, true);
+		if (ret == 0 && kept && !ctx->stream_done)
+			ret = freq_stream_scan(ctx, true);
+	}
+	
+	/* The text is ended even after an error, so that (ctx) can begin another. */
+	int end = freq_end(ctx);
+	return ret ? ret : end;
+}
+
+FreqContext * freq_new(void)
+{
+	FreqContext *ctx = malloc(sizeof(FreqContext));
+	if (ctx == NULL || freq_context_init(ctx)) {
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+void freq_delete(FreqContext *ctx)
+{
+	if (ctx == NULL) return;
+	freq_context_free(ctx);
+	free(ctx);
+}
+
+int freq_begin(FreqContext *ctx, const char *regex, int multiplier)
+{
+	if (ctx->streaming) return -1;
+	
+	int ret = freq_context_compile(ctx, regex);
+	if (ret) return ret;
+	
+	if (freq_cover(ctx, NULL, multiplier) == NULL) return -1;
+	if (hash_init(&ctx->stream)) return -1;
+	ctx->streaming = true;
+	ctx->stream_done = false;
+	ctx->stream_nul_seen = false;
+	ctx->stream_multiplier = multiplier;
+	ctx->stream_matches = 0;
+	ctx->pending_length = 0;
+	return 0;
+}
+
+int freq_feed(FreqContext *ctx, const char *bytes, size_t length)
+{
+	return freq_stream_feed(ctx, bytes, length, false);
+}
+
+int freq_stream_feed(FreqContext *ctx, const char *bytes, size_t length, bool folded)
+{
+	if (!ctx->streaming) return -1;
+	if (freq_budget_spent(ctx)) return 0;
+	ctx->budget_used += length;
+	ctx->coverage[ctx->ncoverage - 1].scanned += length;
+	if (ctx->stream_done) return 0;
+	
+	if (ctx->pending_length + length + 1 > ctx->pending_capacity) {
+		uint64_t capacity = ctx->pending_capacity ? ctx->pending_capacity : 4096;
+		while (capacity < ctx->pending_length + length + 1)
+			capacity *= 2;
+		char *pending = realloc(ctx->pending, capacity);
+		if (pending == NULL) return -1;
+		ctx->pending = pending;
+		ctx->pending_capacity = capacity;
+	}
+	
+	if (folded)
+		memcpy(ctx->pending + ctx->pending_length, bytes, length);
+	else
+		freq_fold(ctx->pending + ctx->pending_length, bytes, length, 
+				ctx->case_sensitive, &ctx->stream_nul_seen);
+	ctx->pending_length += length;
+	ctx->pending[ctx->pending_length] = '\0';
+	
+	/* A scan only gets as far as the last MAX_WORD_LEN bytes, so wait for 
+	 * twice that much. Then each scan drops at least half of what it sees.
+	 */
+	if (ctx->pending_length < 2 * ctx->max_word_len) return 0;
+	return freq_stream_scan(ctx, false);
+}
+
+int freq_end(FreqContext *ctx)
+{
+	if (!ctx->streaming) return -1;
+	
+	int ret = ctx->stream_done ? 0 : freq_stream_scan(ctx, true);
+	
+	/* Weigh the matches the way freq_read_file() does. */
+	if (ret == 0 && ctx->stream_matches > 0)
+		hash_merge(&ctx->hash, ctx->stream, 
+				(double) ctx->stream_multiplier / ctx->stream_matches);
+	
+	hash_clear(&ctx->stream);
+	ctx->streaming = false;
+	ctx->pending_length = 0;
+	return ret;
+}
+
+int freq_read_fd(FreqContext *ctx, int fd, const char *regex, int multiplier)
+{
+	char *block = malloc(FREQ_BLOCK_SIZE);
+	if (block == NULL) return -1;
+	
+	int ret = freq_begin(ctx, regex, multiplier);
+	if (ret) {
+		free(block);
+		return ret;
+	}
+	
+	ret = freq_feed_fd(ctx, fd, block);
+	
+	/* The text is ended even after an error, so that (ctx) can begin another. */
+	int end = freq_end(ctx);
+	free(block);
+	return ret ? ret : end;
+}
+
+int freq_feed_fd(FreqContext *ctx, int fd, char *block)
+{
+	for (;;) {
+		ssize_t got = read(fd, block, FREQ_BLOCK_SIZE);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return got < 0 ? -1 : 0;
+		int ret = freq_feed(ctx, block, got);
+		if (ret) return ret;
+		if (ctx->budget_spent) return 0;
+	}
+}
+
+void freq_set_budget(FreqContext *ctx, double seconds, unsigned long long bytes)
+{
+	ctx->budget_ns = seconds * 1e9;
+	ctx->budget_bytes = bytes;
+	ctx->budget_start = pipe_clock();
+	ctx->budget_used = 0;
+	ctx->budget_spent = false;
+}
+
+bool freq_budget_spent(FreqContext *ctx)
+{
+	if (!ctx->budget_spent && ((ctx->budget_bytes && 
+			ctx->budget_used >= ctx->budget_bytes) || (ctx->budget_ns && 
+			pipe_clock() - ctx->budget_start >= ctx->budget_ns)))
+		ctx->budget_spent = true;
+	return ctx->budget_spent;
+}
+
+FreqCoverage * freq_cover(FreqContext *ctx, const char *name, int multiplier)
+{
+	if (ctx->ncoverage == ctx->coverage_capacity) {
+		size_t capacity = ctx->coverage_capacity ? ctx->coverage_capacity * 2 : 16;
+		FreqCoverage *coverage = realloc(ctx->coverage, sizeof(FreqCoverage) * capacity);
+		if (coverage == NULL) return NULL;
+		ctx->coverage = coverage;
+		ctx->coverage_capacity = capacity;
+	}
+	
+	FreqCoverage *cover = &ctx->coverage[ctx->ncoverage++];
+	cover->name = name;
+	cover->scanned = cover->size = 0;
+	cover->multiplier = multiplier;
+	return cover;
+}
+
+void freq_cover_file(FreqContext *ctx, const char *filename)
+{
+	FreqCoverage *cover = &ctx->coverage[ctx->ncoverage - 1];
+	struct stat st;
+	
+	cover->name = filename;
+	if (stat(filename, &st) == 0)
+		cover->size = st.st_size;
+}
+
+double freq_coverage(const FreqContext *ctx, const FreqCoverage **coverage, 
+		size_t *length)
+{
+	double total = 0, counted = 0;
+	size_t i;
+	
+	for (i = 0; i < ctx->ncoverage; ++i) {
+		total += ctx->coverage[i].multiplier;
+		if (ctx->coverage[i].scanned > 0)
+			counted += ctx->coverage[i].multiplier;
+	}
+	
+	*coverage = ctx->coverage;
+	*length = ctx->ncoverage;
+	return counted > 0 ? total / counted : 0;
+}
+
+int freq_read_dirs(FreqContext *ctx, const char **dirs, size_t ndirs, const char *regex)
+{
+	DirFile *files;
+	size_t nfiles, nbatches = 0, i, j;
+	int ret;
+	
+	if (ctx->budget_ns || ctx->budget_bytes)
+		return -1;
+	ret = dir_walk(&files, &nfiles, dirs, ndirs, ctx->nthreads);
+	if (ret) return ret;
+	if (ctx->dedup && (ret = freq_dedup_dir(ctx, files, &nfiles))) {
+		dir_files_free(files, nfiles);
+		return ret;
+	}
+	
+	FreqBatch *batches = malloc(sizeof(FreqBatch) * (nfiles + 1));
+	if (batches == NULL) {
+		dir_files_free(files, nfiles);
+		return -1;
+	}
+	
+	/* The batches depend only on the sorted files, so the sums are always 
+	 * made in the same order.
+	 */
+	for (i = 0; i < nfiles; i = j) {
+		uint64_t bytes = 0;
+		for (j = i; j < nfiles && j - i < FREQ_BATCH_FILES && 
+				bytes < FREQ_BATCH_BYTES; ++j)
+			bytes += files[j].size;
+		
+		FreqBatch *batch = &batches[nbatches];
+		if (freq_context_copy(&batch->ctx, ctx)) {
+			for (i = 0; i < nbatches; ++i)
+				freq_context_free(&batches[i].ctx);
+			free(batches);
+			dir_files_free(files, nfiles);
+			return -1;
+		}
+		++nbatches;
+		batch->files = files + i;
+		batch->nfiles = j - i;
+		batch->regex = regex;
+		batch->result = 0;
+	}
+	
+	FreqPool pool;
+	if (pool_init(&pool, ctx->nthreads < 1 ? 1 : ctx->nthreads)) {
+		ret = -1;
+	} else {
+		for (i = 0; i < nbatches; ++i) {
+			if (pool_submit(&pool, freq_batch_run, &batches[i])) {
+				batches[i].result = -1;
+				break;
+			}
+		}
+		pool_free(&pool);
+	}
+	
+	for (i = 0; i < nbatches; ++i)
+		if (ret == 0 && batches[i].result)
+			ret = batches[i].result;
+	
+	for (i = 0; i < nbatches; ++i) {
+		if (ret == 0)
+			hash_merge(&ctx->hash, batches[i].ctx.hash, 1);
+		freq_context_free(&batches[i].ctx);
+	}
+	if (ret == 0)
+		printf("done with %zu files in %zu batches\n", nfiles, nbatches);
+	
+	free(batches);
+	dir_files_free(files, nfiles);
+	return ret;
+}
+
+int freq_read_shards(FreqContext *ctx, const char **dirs, size_t ndirs, 
+		const char *regex, int nshards, const char *snap_dir)
+{
+	DirFile *files;
+	size_t nfiles, i;
+	uint64_t total = 0, bytes = 0;
+	int k, ret;
+	
+	if (ctx->budget_ns || ctx->budget_bytes)
+		return -1;
+	if (nshards < 1) nshards = 1;
+	ret = dir_walk(&files, &nfiles, dirs, ndirs, ctx->nthreads);
+	if (ret) return ret;
+	if (ctx->dedup && (ret = freq_dedup_dir(ctx, files, &nfiles))) {
+		dir_files_free(files, nfiles);
+		return ret;
+	}
+	
+	size_t *bounds = malloc(sizeof(size_t) * (nshards + 1));
+	pid_t *pids = malloc(sizeof(pid_t) * nshards);
+	int *tries = malloc(sizeof(int) * nshards);
+	char snap_file[strlen(snap_dir) + 32];
+	if (bounds == NULL || pids == NULL || tries == NULL) {
+		ret = -1;
+		goto done;
+	}
+	
+	/* Shard (k) starts at the first file that starts at or after k/nshards of 
+	 * the bytes.
+	 */
+	for (i = 0; i < nfiles; ++i)
+		total += files[i].size;
+	bounds[0] = 0;
+	for (i = 0, k = 1; k < nshards; ++k) {
+		while (i < nfiles && bytes < total * k / nshards)
+			bytes += files[i++].size;
+		bounds[k] = i;
+	}
+	bounds[nshards] = nfiles;
+	
+	uint64_t job = freq_shard_job(ctx, files, nfiles, regex, nshards);
+	mkdir(snap_dir, 0755);
+	
+	/* The workers start with a copy of what is buffered, so it must be 
+	 * written out first or it would be written again by each of them.
+	 */
+	fflush(stdout);
+	for (k = 0; k < nshards; ++k) {
+		sprintf(snap_file, FREQ_SHARD_FILE, snap_dir, k, nshards);
+		tries[k] = 0;
+		pids[k] = 0;
+		if (snap_check(snap_file, job) == 0)
+			continue;
+		pids[k] = freq_shard_start(ctx, files + bounds[k], bounds[k+1] - bounds[k], 
+				regex, snap_file, job);
+		if (pids[k] < 0) ret = -1;
+	}
+	
+	/* Only the workers are waited for, so that the exit of another child of 
+	 * the process is never taken for a shard's.
+	 */
+	for (k = 0; k < nshards; ++k) {
+		while (pids[k] > 0) {
+			int status;
+			if (waitpid(pids[k], &status, 0) < 0) {
+				if (errno == EINTR) continue;
+				pids[k] = 0;
+				ret = -1;
+				break;
+			}
+			
+			pids[k] = 0;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				break;
+			
+			if (tries[k]++ < FREQ_SHARD_RETRIES) {
+				fprintf(stderr, "shard %d of %d failed, starting it again\n", k, nshards);
+				sprintf(snap_file, FREQ_SHARD_FILE, snap_dir, k, nshards);
+				pids[k] = freq_shard_start(ctx, files + bounds[k], 
+						bounds[k+1] - bounds[k], regex, snap_file, job);
+				if (pids[k] < 0) ret = -1;
+			} else {
+				fprintf(stderr, "shard %d of %d failed\n", k, nshards);
+				ret = -1;
+			}
+		}
+	}
+	
+	for (k = 0; k < nshards && ret == 0; ++k) {
+		sprintf(snap_file, FREQ_SHARD_FILE, snap_dir, k, nshards);
+		ret = snap_read(&ctx->hash, snap_file, job, NULL) ? -1 : 0;
+		if (ret == 0)
+			printf("done with shard %d of %d, %zu files\n", k, nshards, 
+					bounds[k+1] - bounds[k]);
+	}
+	
+done:
+	free(bounds);
+	free(pids);
+	free(tries);
+	dir_files_free(files, nfiles);
+	return ret;
+}
+
+int freq_dedup_files(FreqContext *ctx, const char **files, size_t nfiles)
+{
+	NormText norm;
+	size_t i;
+	int ret = 0;
+	
+	for (i = 0; i < nfiles && ret == 0; ++i) {
+		if (dedup_find(ctx->dedup, files[i]))
+			continue;
+		ret = read_normalized(ctx, &norm, files[i]);
+		if (ret == 0) {
+			ret = dedup_text(ctx->dedup, files[i], norm.text, norm.length);
+			norm_close(&norm);
+		}
+	}
+	return ret;
+}
+
+int freq_dedup_dir(FreqContext *ctx, DirFile *files, size_t *nfiles)
+{
+	size_t i, j, n = *nfiles;
+	int ret = 0;
+	
+	/* Sort pointers to the files by size to find the sizes that are shared; 
+	 * (files) itself stays in order of path, which is the order that decides 
+	 * which copy is kept.
+	 */
+	DirFile **by_size = malloc(sizeof(DirFile *) * (n ? n : 1));
+	bool *shared = calloc(n ? n : 1, sizeof(bool));
+	if (by_size == NULL || shared == NULL) {
+		free(by_size);
+		free(shared);
+		return -1;
+	}
+	for (i = 0; i < n; ++i)
+		by_size[i] = &files[i];
+	qsort(by_size, n, sizeof(DirFile *), freq_dir_file_size_comparator);
+	for (i = 0; i + 1 < n; ++i)
+		if (by_size[i]->size == by_size[i+1]->size)
+			shared[by_size[i] - files] = shared[by_size[i+1] - files] = true;
+	
+	for (i = j = 0; i < n; ++i) {
+		int seen = 0;
+		ctx->dedup->bytes += files[i].size;
+		if (shared[i] && ret == 0) {
+			NormText norm;
+			ret = read_normalized(ctx, &norm, files[i].path);
+			if (ret == 0) {
+				seen = dedup_seen(ctx->dedup, 
+						dedup_fingerprint(norm.text, norm.length, 1));
+				norm_close(&norm);
+				if (seen < 0) ret = -1;
+			}
+		}
+		if (seen > 0) {
+			ctx->dedup->skipped_bytes += files[i].size;
+			++ctx->dedup->skipped_texts;
+			free(files[i].path);
+		} else {
+			files[j++] = files[i];
+		}
+	}
+	*nfiles = j;
+	
+	free(by_size);
+	free(shared);
+	return ret;
+}
+
+int freq_dir_file_size_comparator(const void *x, const void *y)
+{
+	const DirFile *xf = *(const DirFile * const *) x;
+	const DirFile *yf = *(const DirFile * const *) y;
+	
+	if (xf->size < yf->size) return -1;
+	else if (xf->size > yf->size) return 1;
+	else return 0;
+}
+
+pid_t freq_shard_start(FreqContext *ctx, const DirFile *files, size_t nfiles, 
+		const char *regex, const char *snap_file, uint64_t job)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+	
+	FreqBatch batch;
+	if (freq_context_copy(&batch.ctx, ctx))
+		_exit(1);
+	batch.files = files;
+	batch.nfiles = nfiles;
+	batch.regex = regex;
+	batch.result = 0;
+	freq_batch_run(&batch);
+	
+	if (batch.result == 0)
+		batch.result = snap_write(snap_file, batch.ctx.hash, job, (SnapCursor) { 0, 0 });
+	_exit(batch.result ? 1 : 0);
+}
+
+uint64_t freq_shard_job(const FreqContext *ctx, const DirFile *files, size_t nfiles, 
+		const char *regex, int nshards)
+{
+	uint64_t job = hash_function(regex);
+	size_t i;
+	
+	job = job * HASH_MULT + nshards;
+	job = job * HASH_MULT + ctx->case_sensitive;
+	job = job * HASH_MULT + ctx->max_word_len;
+	for (i = 0; i < nfiles; ++i) {
+		job = job * HASH_MULT + hash_function(files[i].path);
+		job = job * HASH_MULT + files[i].weight;
+		job = job * HASH_MULT + files[i].size;
+	}
+	return job;
+}
+
+void freq_batch_run(void *arg)
+{
+	FreqBatch *batch = arg;
+	size_t i;
+	
+	char *block = malloc(FREQ_BLOCK_SIZE);
+	if (block == NULL) {
+		batch->result = -1;
+		return;
+	}
+	
+	for (i = 0; i < batch->nfiles && batch->result == 0; ++i) {
+		int fd = open(batch->files[i].path, O_RDONLY);
+		if (fd < 0) {
+			batch->result = -1;
+			break;
+		}
+		
+		int ret = freq_begin(&batch->ctx, batch->regex, batch->files[i].weight);
+		if (ret == 0) {
+			ret = freq_feed_fd(&batch->ctx, fd, block);
+			int end = freq_end(&batch->ctx);
+			if (ret == 0) ret = end;
+		}
+		close(fd);
+		batch->result = ret;
+	}
+	
+	free(block);
+}
+
+int freq_foreach(const FreqContext *ctx, 
+		int (*f)(const char *key, double value, void *arg), void *arg)
+{
+	Pair *pairs;
+	size_t i, length;
+	int ret = 0;
+	
+	if (hash_sort(&pairs, &length, ctx->hash)) return -1;
+	for (i = 0; i < length && ret == 0; ++i)
+		ret = (*f)(pairs[i].key, pairs[i].value, arg);
+	
+	free(pairs);
+	return ret;
+}
+
+void freq_fold(char *dest, const char *src, size_t length, bool case_sensitive, 
+		bool *nul_seen)
+{
+	size_t i;
+	for (i = 0; i < length; ++i) {
+		char c = src[i];
+		if (!case_sensitive) c = tolower(c);
+		if (c == '\0') *nul_seen = true;
+		if (!*nul_seen) c = (char) tolower((int) c);
+		dest[i] = c;
+	}
+}
+
+int freq_stream_scan(FreqContext *ctx, bool final)
+{
+	uint64_t next;
+	if (ctx->pending_length == 0) return 0;
+	
+	int count = freq_scan_plan(ctx, &ctx->stream, ctx->pending, ctx->pending_length, 
+			&ctx->plan, ctx->state, NULL, 1, final ? NULL : &next);
+	if (count < 0) return count;
+	ctx->stream_matches += count;
+	
+	if (final) {
+		ctx->pending_length = 0;
+	} else if (next == FREQ_SCAN_DONE) {
+		ctx->stream_done = true;
+		ctx->pending_length = 0;
+	} else {
+		memmove(ctx->pending, ctx->pending + next, ctx->pending_length - next);
+		ctx->pending_length -= next;
+		ctx->pending[ctx->pending_length] = '\0';
+	}
+	
+	return 0;
+}
+
+/* 
+ * Finds all n-grams of (wordcount) words. Uses all files except for 
+ * programming files.
+ */
+int find_n_words(FreqContext *ctx, int wordcount)
+{
+	int ret = 0;
+	size_t i;
+	if (ctx->dedup && (ret = freq_dedup_files(ctx, ctx->word_files, ctx->nword_files)))
+		return ret;
+	for (i = 0; i < ctx->nword_files; ++i) {
+		ret = find_n_words_for_file(ctx, ctx->word_files[i], wordcount, 
+				ctx->word_multipliers[i]);
+		if (ret) return ret;
+		printf("done with %s at %d\n", ctx->word_files[i], ctx->word_multipliers[i]);
+	}
+	
+	return ret;	
+}
+
+int find_n_words_for_file(FreqContext *ctx, const char *filename, int wordcount, int multiplier)
+{
+	return find_n_words_from(ctx, filename, wordcount, multiplier, 0, NULL);
+}
+
+int find_n_words_from(FreqContext *ctx, const char *filename, int wordcount, 
+		int multiplier, uint64_t start, FreqCheckpoint *cp)
+{
+	NormText norm;
+	int ret = read_normalized(ctx, &norm, filename);
+	if (ret)
+		return ret;
+	
+	const char *buffer = norm.text;
+	uint64_t length = norm.length;
+	
+	WordList words;
+	if (words_tokenize(&words, buffer, length)) {
+		norm_close(&norm);
+		return -1;
+	}
+	
+	size_t count = words.length, k;
+	size_t ngrams = freq_ngram_count(&words, length, wordcount);
+	
+	/* An n-gram is skipped when its first word starts in a block that is a 
+	 * copy. A file that no job has looked at yet is looked at now.
+	 */
+	const DedupKept *kept = NULL;
+	size_t range = 0;
+	if (ctx->dedup && (kept = dedup_find(ctx->dedup, filename)) == NULL) {
+		if (dedup_text(ctx->dedup, filename, buffer, length)) {
+			words_free(&words);
+			norm_close(&norm);
+			return -1;
+		}
+		kept = dedup_find(ctx->dedup, filename);
+	}
+	
+	/* The delimiter is folded as the text was. An n-gram is in the document 
+	 * that its first word starts in, and n-grams that run on into the next 
+	 * document are counted as they always have been. Each document is stamped 
+	 * with its number in ctx->ndocs.
+	 */
+	size_t delimiter_length = ctx->doc_delimiter ? strlen(ctx->doc_delimiter) : 0;
+	char delimiter[delimiter_length + 1];
+	for (k = 0; k < delimiter_length; ++k)
+		delimiter[k] = (char) tolower((int) ctx->doc_delimiter[k]);
+	Window docs;
+	window_init(&docs, WINDOW_DOCUMENTS, 1, 1, buffer, length, delimiter, delimiter_length);
+	
+	char *key = NULL;
+	size_t key_capacity = 0, t;
+	for (t = start; t < ngrams && ret == 0; ++t) {
+		/* The clock is only looked at now and then, since it costs more than 
+		 * an n-gram.
+		 */
+		if (cp && t % 4096 == 0 && 
+				pipe_clock() - cp->last >= ctx->checkpoint_seconds * 1000000000 && 
+				(ret = freq_checkpoint(ctx, cp, cp->index, t)))
+			break;
+		
+		uint64_t first = t < count ? words.offsets[2*t] : length;
+		if (kept) {
+			uint64_t at = first < length ? first : length - 1;
+			while (range < kept->length && kept->ranges[2*range+1] <= at)
+				++range;
+			if (range == kept->length || at < kept->ranges[2*range])
+				continue;
+		}
+		
+		long j = freq_ngram_key(&key, &key_capacity, buffer, &words, t, wordcount);
+		if (j < 0) {
+			ret = -1;
+			break;
+		}
+		
+		size_t hashval = hash_function(key);
+		hash_inc_hashed(&ctx->hash, key, j, hashval, multiplier);
+		if (delimiter_length > 0) {
+			uint64_t doc = window_unit(&docs, first);
+			hash_inc_once(&ctx->docs, key, j, hashval, ctx->ndocs + 1 + doc);
+		}
+	}
+	
+	/* Every document of the file is counted, however far the n-grams go. */
+	if (delimiter_length > 0)
+		ctx->ndocs += docs.units;
+	
+	free(key);
+	words_free(&words);
+	norm_close(&norm);
+	return ret;
+}
+
+int find_n_words_windowed(FreqContext *ctx, const char *filename, int wordcount, 
+		WindowUnit unit, uint64_t size, uint64_t step, 
+		int (*f)(uint64_t window, Hash counts, void *arg), void *arg)
+{
+	NormText norm;
+	int ret = read_normalized(ctx, &norm, filename);
+	if (ret)
+		return ret;
+	
+	const char *buffer = norm.text;
+	uint64_t length = norm.length;
+	
+	WordList words;
+	if (words_tokenize(&words, buffer, length)) {
+		norm_close(&norm);
+		return -1;
+	}
+	size_t count = words.length, k;
+	size_t ngrams = freq_ngram_count(&words, length, wordcount);
+	
+	size_t delimiter_length = ctx->doc_delimiter ? strlen(ctx->doc_delimiter) : 0;
+	char delimiter[delimiter_length + 1];
+	for (k = 0; k < delimiter_length; ++k)
+		delimiter[k] = (char) tolower((int) ctx->doc_delimiter[k]);
+	
+	/* (head) finds the unit of each n-gram as it comes into the windows, and 
+	 * (tail) that of each one as it leaves them.
+	 */
+	Window head, tail;
+	window_init(&head, unit, size, step, buffer, length, delimiter, delimiter_length);
+	tail = head;
+	uint64_t nwindows = window_count(&head), w = 0;
+	
+	Hash counts;
+	hash_init(&counts);
+	char *key = NULL;
+	size_t key_capacity = 0, t, out = 0;
+	long j;
+	
+	for (t = 0; t <= ngrams && ret == 0; ++t) {
+		uint64_t u = t < ngrams ? 
+				window_unit(&head, t < count ? words.offsets[2*t] : length) : UINT64_MAX;
+		
+		/* Finish every window that ends before the n-gram, and take the n-grams 
+		 * that only it held out of the counts: all of them if the windows do 
+		 * not overlap, and otherwise those up to where the next one starts.
+		 */
+		while (w < nwindows && (u == UINT64_MAX || u >= w * step + size) && ret == 0) {
+			ret = (*f)(w, counts, arg);
+			++w;
+			if (step >= size) {
+				hash_clear(&counts);
+				hash_init(&counts);
+				out = t;
+				continue;
+			}
+			for (; out < t && ret == 0; ++out) {
+				uint64_t leaving = out < count ? words.offsets[2*out] : length;
+				if (window_unit(&tail, leaving) >= w * step)
+					break;
+				if ((j = freq_ngram_key(&key, &key_capacity, buffer, &words, out, 
+						wordcount)) < 0) {
+					ret = -1;
+					break;
+				}
+				Pair *pair = hash_find(counts, key, hash_function(key));
+				if (pair && (pair->value -= 1) <= 0)
+					hash_remove(&counts, pair);
+			}
+		}
+		
+		/* An n-gram between two windows that do not touch is in neither. */
+		if (t == ngrams || ret || w == nwindows || u < w * step)
+			continue;
+		if ((j = freq_ngram_key(&key, &key_capacity, buffer, &words, t, wordcount)) < 0)
+			ret = -1;
+		else
+			hash_inc_hashed(&counts, key, j, hash_function(key), 1);
+	}
+	
+	free(key);
+	hash_clear(&counts);
+	words_free(&words);
+	norm_close(&norm);
+	return ret;
+}
+
+size_t freq_ngram_count(const WordList *words, uint64_t length, int wordcount)
+{
+	/* Each n-gram starts at a word and takes the next (wordcount) words. If 
+	 * the buffer does not end in a word, the last n-gram runs out of words 
+	 * one short and is counted anyway, ending in a space (or as the empty 
+	 * string for single words), as it always has been.
+	 */
+	size_t count = words->length;
+	uint64_t tail = count ? words->offsets[2 * count - 1] : 0;
+	size_t ngrams = count + 2 > (size_t) wordcount ? count + 2 - wordcount : 0;
+	if (tail == length && ngrams > 0)
+		--ngrams;
+	return ngrams;
+}
+
+long freq_ngram_key(char **key, size_t *capacity, const char *buffer, 
+		const WordList *words, size_t t, int wordcount)
+{
+	size_t count = words->length, k, j = 0;
+	size_t needed = wordcount;
+	for (k = t; k < t + wordcount && k < count; ++k)
+		needed += words->offsets[2*k + 1] - words->offsets[2*k];
+	
+	if (needed > *capacity) {
+		char *grown = realloc(*key, needed);
+		if (grown == NULL)
+			return -1;
+		*key = grown;
+		*capacity = needed;
+	}
+	
+	for (k = t; k < t + wordcount; ++k) {
+		if (k > t) (*key)[j++] = ' ';
+		if (k < count) {
+			size_t word_length = words->offsets[2*k + 1] - words->offsets[2*k];
+			memcpy(*key + j, buffer + words->offsets[2*k], word_length);
+			j += word_length;
+		}
+	}
+	(*key)[j] = '\0';
+	return j;
+}
+
+int find_n_words_edited(FreqContext *ctx, const char *filename, int wordcount, 
+		int multiplier, const FreqEdit *edits, size_t nedits)
+{
+	struct stat st;
+	size_t e, f;
+	int ret = 0;
+	
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	
+	/* The file is mapped rather than read, so that only the pages around the 
+	 * edits are ever read from the disk.
+	 */
+	uint64_t length = st.st_size;
+	const char *text = "";
+	void *map = NULL;
+	if (length > 0) {
+		map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		text = map;
+	}
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	
+	Hash delta;
+	hash_init(&delta);
+	int64_t shift = 0; /* how far the text has moved up to the current edit */
+	
+	/* Whether there is a NUL before the text around the edits, which is only 
+	 * looked for as far as that text, and only when the case is kept, since 
+	 * otherwise read_file() folds the whole text the same way.
+	 */
+	bool nul_seen = false;
+	uint64_t nul_checked = 0;
+	
+	for (e = 0; e < nedits && ret == 0; e = f) {
+		/* The text around an edit runs on into that around the next ones if 
+		 * they are close enough, and is then counted with them.
+		 */
+		uint64_t start = edits[e].offset + shift;
+		if (start + edits[e].new_length > length) {
+			ret = -3;
+			break;
+		}
+		uint64_t left = freq_edit_left(text, start, wordcount);
+		uint64_t right = freq_edit_right(text, length, start + edits[e].new_length, 
+				wordcount);
+		int64_t next_shift = shift + edits[e].new_length - edits[e].old_length;
+		
+		for (f = e + 1; f < nedits; ++f) {
+			uint64_t next = edits[f].offset + next_shift;
+			if (edits[f].offset < edits[f - 1].offset + edits[f - 1].old_length || 
+					next + edits[f].new_length > length) {
+				ret = -3;
+				break;
+			}
+			if (next > right && freq_edit_left(text, next, wordcount) >= right)
+				break;
+			right = freq_edit_right(text, length, next + edits[f].new_length, wordcount);
+			next_shift += edits[f].new_length - edits[f].old_length;
+		}
+		if (ret)
+			break;
+		uint64_t old_length = right - left - (next_shift - shift);
+		
+		/* The text as it was is the text around the edits now, with the old 
+		 * text of each edit in place of the new.
+		 */
+		char *before = malloc(old_length + 1);
+		char *after = malloc(right - left + 1);
+		if (before == NULL || after == NULL) {
+			free(before);
+			free(after);
+			ret = -1;
+			break;
+		}
+		uint64_t from = left, k = 0;
+		size_t g;
+		for (g = e; g < f; ++g) {
+			uint64_t at = edits[g].offset + shift;
+			if (ctx->case_sensitive && (memchr(text + at, '\0', edits[g].new_length) || 
+					memchr(edits[g].old_text, '\0', edits[g].old_length)))
+				ret = -2;
+			memcpy(before + k, text + from, at - from);
+			k += at - from;
+			memcpy(before + k, edits[g].old_text, edits[g].old_length);
+			k += edits[g].old_length;
+			from = at + edits[g].new_length;
+			shift += edits[g].new_length - edits[g].old_length;
+		}
+		memcpy(before + k, text + from, right - from);
+		memcpy(after, text + left, right - left);
+		
+		if (ctx->case_sensitive && !nul_seen) {
+			nul_seen = memchr(text + nul_checked, '\0', left - nul_checked) != NULL;
+			nul_checked = left;
+		}
+		if (ret == 0)
+			ret = freq_edit_count(&delta, before, old_length, right == length, 
+					wordcount, -multiplier, ctx->case_sensitive, nul_seen);
+		if (ret == 0)
+			ret = freq_edit_count(&delta, after, right - left, right == length, 
+					wordcount, multiplier, ctx->case_sensitive, nul_seen);
+		free(before);
+		free(after);
+	}
+	
+	/* The changes are only made once every edit has been counted. A key that 
+	 * has gone from the file leaves the counts altogether.
+	 */
+	size_t i, j;
+	for (i = 0; i < delta.length && ret == 0; ++i) {
+		for (j = 0; j < delta.buckets[i].length; ++j) {
+			const Pair *change = &delta.buckets[i].pairs[j];
+			if (change->value == 0)
+				continue;
+			hash_inc_hashed(&ctx->hash, change->key, strlen(change->key), 
+					change->hashval, change->value);
+			Pair *pair = hash_find(ctx->hash, change->key, change->hashval);
+			if (pair && pair->value == 0)
+				hash_remove(&ctx->hash, pair);
+		}
+	}
+	
+	hash_clear(&delta);
+	if (map)
+		munmap(map, length);
+	return ret;
+}
+
+int freq_edit_count(Hash *delta, char *region, uint64_t length, bool at_end, 
+		int wordcount, double value, bool case_sensitive, bool nul_seen)
+{
+	WordList words;
+	
+	freq_fold(region, region, length, case_sensitive, &nul_seen);
+	region[length] = '\0';
+	
+	if (words_tokenize(&words, region, length))
+		return -1;
+	
+	size_t ngrams;
+	if (at_end)
+		ngrams = freq_ngram_count(&words, length, wordcount);
+	else
+		ngrams = words.length >= (size_t) wordcount ? words.length - wordcount + 1 : 0;
+	
+	char *key = NULL;
+	size_t key_capacity = 0, t;
+	int ret = 0;
+	for (t = 0; t < ngrams; ++t) {
+		long j = freq_ngram_key(&key, &key_capacity, region, &words, t, wordcount);
+		if (j < 0) {
+			ret = -1;
+			break;
+		}
+		hash_inc_hashed(delta, key, j, hash_function(key), value);
+	}
+	
+	free(key);
+	words_free(&words);
+	return ret;
+}
+
+uint64_t freq_edit_left(const char *text, uint64_t at, int wordcount)
+{
+	int k = 0;
+	
+	/* Back out of the word that the edit may have changed, then past 
+	 * (wordcount) more, since an n-gram that starts in one of those can run 
+	 * into the edit. The text then starts after a byte that no word can hold. 
+	 * A run of word bytes is a word if it holds an alphanumeric, and not if it 
+	 * is only apostrophes.
+	 */
+	while (at > 0 && freq_word_byte(text[at - 1]))
+		--at;
+	while (at > 0 && k < wordcount) {
+		bool word = false;
+		while (at > 0 && !freq_word_byte(text[at - 1]))
+			--at;
+		while (at > 0 && freq_word_byte(text[at - 1]))
+			word |= text[--at] != '\'';
+		k += word;
+	}
+	return at;
+}
+
+uint64_t freq_edit_right(const char *text, uint64_t length, uint64_t at, int wordcount)
+{
+	int k = 0;
+	
+	while (at < length && freq_word_byte(text[at]))
+		++at;
+	while (at < length && k < wordcount) {
+		bool word = false;
+		while (at < length && !freq_word_byte(text[at]))
+			++at;
+		while (at < length && freq_word_byte(text[at]))
+			word |= text[at++] != '\'';
+		k += word;
+	}
+	return at;
+}
+
+bool freq_word_byte(char c)
+{
+	return (c >= 0 && isalnum((int) c)) || c == '\'';
+}
+
+int freq_read_checkpointed(FreqContext *ctx, const char *regex, int wordcount, 
+		const char *checkpoint_file, bool resume)
+{
+	FreqCheckpoint cp;
+	SnapCursor cursor = { 0, 0 };
+	const char **files = regex ? ctx->files : ctx->word_files;
+	const int *multipliers = regex ? ctx->multipliers : ctx->word_multipliers;
+	size_t nfiles = regex ? ctx->nfiles : ctx->nword_files;
+	int ret = 0;
+	
+	cp.file = checkpoint_file;
+	cp.job = freq_checkpoint_job(ctx, regex, wordcount);
+	cp.last = pipe_clock();
+	
+	/* Every file is looked at again on a resume, so that the same blocks are 
+	 * skipped as before.
+	 */
+	if (ctx->dedup && (ret = freq_dedup_files(ctx, files, nfiles)))
+		return ret;
+	
+	if (resume) {
+		ret = snap_read(&ctx->hash, checkpoint_file, cp.job, &cursor);
+		if (ret == -2)
+			fprintf(stderr, "%s is a checkpoint of another job; starting over\n", 
+					checkpoint_file);
+		else if (ret)
+			fprintf(stderr, "no checkpoint in %s; starting over\n", checkpoint_file);
+		else
+			fprintf(stderr, "resuming at %s, offset %llu\n", 
+					cursor.file < nfiles ? files[cursor.file] : "the end", 
+					(unsigned long long) cursor.offset);
+		if (ret) cursor.file = cursor.offset = 0;
+		ret = 0;
+	}
+	
+	for (cp.index = cursor.file; cp.index < nfiles && ret == 0; ++cp.index) {
+		const char *filename = files[cp.index];
+		if (regex)
+			ret = freq_read_file(ctx, filename, regex, multipliers[cp.index]);
+		else
+			ret = find_n_words_from(ctx, filename, wordcount, multipliers[cp.index], 
+					cp.index == cursor.file ? cursor.offset : 0, &cp);
+		if (ret) break;
+		printf("done with %s at %d\n", filename, multipliers[cp.index]);
+		
+		if (pipe_clock() - cp.last >= ctx->checkpoint_seconds * 1000000000)
+			ret = freq_checkpoint(ctx, &cp, cp.index + 1, 0);
+	}
+	
+	if (ret == 0)
+		ret = freq_checkpoint(ctx, &cp, nfiles, 0);
+	return ret;
+}
+
+int freq_checkpoint(FreqContext *ctx, FreqCheckpoint *cp, uint64_t index, uint64_t offset)
+{
+	SnapCursor cursor = { index, offset };
+	int ret = snap_write(cp->file, ctx->hash, cp->job, cursor);
+	cp->last = pipe_clock();
+	return ret;
+}
+
+uint64_t freq_checkpoint_job(const FreqContext *ctx, const char *regex, int wordcount)
+{
+	const char **files = regex ? ctx->files : ctx->word_files;
+	const int *multipliers = regex ? ctx->multipliers : ctx->word_multipliers;
+	size_t nfiles = regex ? ctx->nfiles : ctx->nword_files;
+	uint64_t job = regex ? hash_function(regex) : (uint64_t) wordcount;
+	struct stat st;
+	size_t i;
+	
+	job = job * HASH_MULT + ctx->case_sensitive;
+	job = job * HASH_MULT + ctx->max_word_len;
+	for (i = 0; i < nfiles; ++i) {
+		job = job * HASH_MULT + hash_function(files[i]);
+		job = job * HASH_MULT + multipliers[i];
+		if (stat(files[i], &st) == 0) {
+			job = job * HASH_MULT + st.st_size;
+			job = job * HASH_MULT + st.st_mtim.tv_sec;
+		}
+	}
+	return job;
+}
+
+int find_n_words_for_corpus(FreqContext *ctx, const char *ids_file, const char *vocab_file, 
+		int wordcount, int multiplier)
+{
+	Corpus corpus;
+	int ret = corpus_open(&corpus, ids_file, vocab_file);
+	if (ret)
+		return ret;
+	
+	ret = corpus_count_words(&ctx->hash, &corpus, wordcount, multiplier);
+	corpus_close(&corpus);
+	return ret;
+}
+
+int freq_tokenize_file(const FreqContext *ctx, const char *filename, const char *ids_file, 
+		const char *vocab_file)
+{
+	NormText norm;
+	int ret = read_normalized(ctx, &norm, filename);
+	if (ret)
+		return ret;
+	
+	ret = corpus_write(norm.text, norm.length, ids_file, vocab_file);
+	norm_close(&norm);
+	return ret;
+}
+
+int freq_scan(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const RegexBackend *backend, 
+		void *state, bool overlap, const ByteClass *prefilter, double adjusted_multiplier, 
+		uint64_t *next)
+{
+	int ret = 0;
+	regmatch_t matchptr[2];
+	
+	int matches = 0;
+	uint64_t i = 0, end;
+	
+	while (i < length) {
+		if (next && i + ctx->max_word_len > length) 
+			break;
+		
+		matchptr[0].rm_so = matchptr[0].rm_eo = 0;	
+		matchptr[1].rm_so = matchptr[1].rm_eo = 0;	
+
+		/* Limit the string size to MAX_WORD_LEN so that the regular expression 
+		 * only tries to match the first MAX_WORD_LEN characters, instead of 
+		 * the entire file.
+		 */
+		end = i + ctx->max_word_len < length ? i + ctx->max_word_len : length;
+		char holder = buffer[end];
+		buffer[end] = '\0';
+		
+		/* Jump to the first byte that can begin a match. The string still ends 
+		 * where it did, so regexec() finds the same match that it would have 
+		 * found from (i). If the jump lands on a NUL, there is no such match.
+		 */
+		if (prefilter) {
+			i += byteclass_find(prefilter, buffer + i, end - i);
+			if (i == end || buffer[i] == '\0') {
+				buffer[end] = holder;
+				goto done;
+			}
+		}
+				
+		ret = backend->exec(state, buffer + i, matchptr);
+		buffer[end] = holder;
+		
+		if (ret == 0) {
+			if (hash) {
+				freq_hash_inc(hash, buffer + i, adjusted_multiplier, matchptr);
+			}
+			++matches;
+		} else if (ret == REG_ESPACE) {
+			return -4;
+		} else goto done; /* There are no more matches. */
+
+		if (overlap) i += matchptr[0].rm_so + 1;
+		else i += matchptr[0].rm_eo;
+	}	
+	
+	if (next) *next = i;
+	return matches;
+	
+done:
+	if (next) *next = FREQ_SCAN_DONE;
+	return matches;
+}
+
+int freq_scan_plan(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const Plan *plan, 
+		void *state, const uint64_t *legal, double adjusted_multiplier, uint64_t *next)
+{
+	ByteSet first;
+	ByteClass prefilter;
+	
+	switch (plan->engine) {
+	case ENGINE_CLASS_DENSE:
+	case ENGINE_CLASS_HASH:
+	case ENGINE_CLASS_RUNS:
+		return freq_scan_class(ctx, hash, buffer, length, &plan->set, plan->n, legal, 
+				adjusted_multiplier, next);
+	
+	case ENGINE_RUNS:
+		return freq_scan_runs(ctx, hash, buffer, length, plan, adjusted_multiplier, next);
+	
+	case ENGINE_REGEXEC_PREFILTER:
+		first = plan->first;
+		byteset_add(&first, '\0');
+		byteclass_init(&prefilter, &first);
+		return freq_scan(ctx, hash, buffer, length, plan->backend, state, plan->overlap, &prefilter, 
+				adjusted_multiplier, next);
+	
+	default:
+		return freq_scan(ctx, hash, buffer, length, plan->backend, state, plan->overlap, NULL, 
+				adjusted_multiplier, next);
+	}
+}
+
+int freq_scan_runs(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const Plan *plan, 
+		double adjusted_multiplier, uint64_t *next)
+{
+	regmatch_t matchptr[2];
+	ByteSet outside_set;
+	ByteClass inside, outside;
+	int c, matches = 0;
+	
+	byteset_clear(&outside_set);
+	for (c = 0; c < 256; ++c)
+		if (!byteset_has(&plan->set, c))
+			byteset_add(&outside_set, c);
+	byteclass_init(&inside, &plan->set);
+	byteclass_init(&outside, &outside_set);
+	
+	uint64_t i = 0, start, run_end, end, nul = 0;
+	bool nul_known = false;
+	
+	while (i < length) {
+		if (next && i + ctx->max_word_len > length) 
+			break;
+		
+		/* regexec() sees the string from (i) to the end of the MAX_WORD_LEN 
+		 * window or the first NUL, whichever comes first.
+		 */
+		if (!nul_known || nul < i) {
+			const char *p = memchr(buffer + i, '\0', length - i);
+			nul = p ? (uint64_t) (p - buffer) : length;
+			nul_known = true;
+		}
+		end = i + ctx->max_word_len < length ? i + ctx->max_word_len : length;
+		if (nul < end) end = nul;
+		
+		/* The leftmost match is the first run in the window that is long 
+		 * enough, and it takes the whole run. If there is none, freq_scan() 
+		 * would stop here.
+		 */
+		start = i;
+		for (;;) {
+			start += byteclass_find(&inside, buffer + start, end - start);
+			if (start == end)
+				goto done;
+			run_end = start + byteclass_find(&outside, buffer + start, end - start);
+			if (run_end - start >= (uint64_t) plan->min_length)
+				break;
+			start = run_end;
+		}
+		
+		matchptr[0].rm_so = 0;
+		matchptr[0].rm_eo = run_end - start;
+		matchptr[1].rm_so = plan->from_end ? 
+				matchptr[0].rm_eo - plan->offset : plan->offset;
+		matchptr[1].rm_eo = matchptr[1].rm_so + plan->length;
+		
+		if (hash) {
+			freq_hash_inc(hash, buffer + start, adjusted_multiplier, matchptr);
+		}
+		++matches;
+		i = run_end;
+	}
+	
+	if (next) *next = i;
+	return matches;
+	
+done:
+	if (next) *next = FREQ_SCAN_DONE;
+	return matches;
+}
+
+int freq_scan_class(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const ByteSet *set, 
+		int n, const uint64_t *legal_bits, double adjusted_multiplier, uint64_t *next)
+{
+	if (n > 64 || memchr(buffer, '\0', length))
+		return freq_scan_class_runs(ctx, hash, buffer, length, set, n, adjusted_multiplier, 
+				next);
+	
+	int k, matches = 0;
+	char c;
+	ByteSet legal_set;
+	byteset_clear(&legal_set);
+	for (k = 1; k < 256; ++k) {
+		c = (char) k;
+		if (legal_chars(&c, 1))
+			byteset_add(&legal_set, k);
+	}
+	
+	/* Only check legal_chars() if the set holds bytes that it rejects. */
+	ByteSet both = *set;
+	byteset_union(&both, &legal_set);
+	bool check_legal = !byteset_equal(&both, &legal_set);
+	
+	ByteClass cls, legal;
+	byteclass_init(&cls, set);
+	byteclass_init(&legal, &legal_set);
+	
+	DenseTable dense;
+	bool use_dense = hash && dense_init(&dense, set, n) == 0;
+	
+	size_t roll = 0, power = hash_power(n), seed = HASH_SEED * power;
+	bool roll_valid = false;
+	uint64_t base, start, roll_start = 0, resume = 0;
+	uint64_t cur, next_mask, starts, legal_cur = 0, legal_next = 0, legal_starts = 0;
+	
+	/* Bit j of (starts) is set iff the n bytes at (base + j) are all members: 
+	 * AND the mask with itself shifted by 1 through n - 1, pulling bits in from 
+	 * the next block. Since n <= 64, an n-gram never reaches past that block.
+	 */
+	cur = byteclass_mask(&cls, buffer, length < 64 ? length : 64);
+	if (check_legal)
+		legal_cur = legal_bits ? legal_bits[0] : 
+				byteclass_mask(&legal, buffer, length < 64 ? length : 64);
+	
+	for (base = 0; base < length; base += 64) {
+		next_mask = legal_next = 0;
+		if (base + 64 < length) {
+			size_t span = length - base - 64 < 64 ? length - base - 64 : 64;
+			next_mask = byteclass_mask(&cls, buffer + base + 64, span);
+			if (check_legal)
+				legal_next = legal_bits ? legal_bits[base / 64 + 1] : 
+						byteclass_mask(&legal, buffer + base + 64, span);
+		}
+		
+		starts = cur;
+		legal_starts = legal_cur;
+		for (k = 1; k < n; ++k) {
+			starts &= (cur >> k) | (next_mask << (64 - k));
+			if (check_legal)
+				legal_starts &= (legal_cur >> k) | (legal_next << (64 - k));
+		}
+		
+		while (starts) {
+			start = base + __builtin_ctzll(starts);
+			
+			/* The same stopping rule as freq_scan_class_runs(). */
+			if (start + n > resume + ctx->max_word_len || 
+					(next && resume + ctx->max_word_len > length))
+				goto done;
+			
+			if (hash && (!check_legal || (legal_starts >> (start - base)) & 1)) {
+				if (use_dense) {
+					dense_inc(&dense, buffer + start, adjusted_multiplier);
+				} else {
+					/* Slide the rolling hash forward to (start), or start it over 
+					 * if that would take longer.
+					 */
+					if (!roll_valid || start - roll_start > (uint64_t) n) {
+						roll = 0;
+						for (k = 0; k < n; ++k)
+							roll = roll * HASH_MULT + HASH_BYTE(buffer[start + k]);
+						roll_start = start;
+						roll_valid = true;
+					}
+					for (; roll_start < start; ++roll_start)
+						roll = roll * HASH_MULT + HASH_BYTE(buffer[roll_start + n]) - 
+								HASH_BYTE(buffer[roll_start]) * power;
+					
+					hash_inc_hashed(hash, buffer + start, n, seed + roll, 
+							adjusted_multiplier);
+				}
+			}
+			
+			++matches;
+			resume = start + 1;
+			starts &= starts - 1;
+		}
+		
+		cur = next_mask;
+		legal_cur = legal_next;
+	}
+	
+done:
+	/* The scan has stopped for good, unless the window from (resume) has not 
+	 * all arrived.
+	 */
+	if (next)
+		*next = resume + ctx->max_word_len > length ? resume : FREQ_SCAN_DONE;
+	
+	if (use_dense)
+		dense_flush(&dense, hash);
+	
+	return matches;
+}
+
+int freq_scan_class_runs(const FreqContext *ctx, Hash *hash, char *buffer, uint64_t length, 
+		const ByteSet *set, 
+		int n, double adjusted_multiplier, uint64_t *next)
+{
+	int matches = 0;
+	uint64_t i, start, run = 0, legal_run = 0, resume = 0, last_nul = 0;
+	bool nul_seen = false;
+	
+	/* (roll) is the sum part of hash_function() for the (n) bytes that end at 
+	 * (i), so each n-gram is hashed with one multiply instead of n.
+	 */
+	size_t roll = 0, power = hash_power(n), seed = HASH_SEED * power;
+	
+	/* (run) is the number of bytes from (set) that end at (i). Every time it 
+	 * reaches (n), an n-gram ends at (i). (legal_run) does the same for the 
+	 * bytes that legal_chars() accepts.
+	 */
+	for (i = 0; i < length; ++i) {
+		roll = roll * HASH_MULT + HASH_BYTE(buffer[i]);
+		if (i >= (uint64_t) n)
+			roll -= HASH_BYTE(buffer[i - n]) * power;
+		
+		legal_run = legal_chars(buffer + i, 1) ? legal_run + 1 : 0;
+		
+		if (byteset_has(set, buffer[i])) {
+			++run;
+		} else {
+			run = 0;
+			if (buffer[i] == '\0') {
+				nul_seen = true;
+				last_nul = i;
+			}
+		}
+		
+		if (run < (uint64_t) n)
+			continue;
+		
+		/* freq_scan() resumes one byte after the previous match and stops as 
+		 * soon as the next MAX_WORD_LEN bytes (or the bytes up to a NUL) hold no 
+		 * match. Stop at the same place so that the counts agree.
+		 */
+		start = i + 1 - n;
+		if (start + n > resume + ctx->max_word_len || (nul_seen && last_nul >= resume) || 
+				(next && resume + ctx->max_word_len > length))
+			break;
+		
+		if (hash && legal_run >= (uint64_t) n) {
+			hash_inc_hashed(hash, buffer + start, n, seed + roll, adjusted_multiplier);
+		}
+		++matches;
+		resume = start + 1;
+	}
+	
+	/* As in freq_scan_class(). */
+	if (next)
+		*next = resume + ctx->max_word_len > length ? resume : FREQ_SCAN_DONE;
+	return matches;
+}
+
+int freq_hash_inc(Hash *hash, char *sequence, double value, regmatch_t matchptr[])
+{
+	size_t length;
+	
+	/* If the regex contained at least one subexpression, use the sequence 
+	 * contained within the first subexpression. Otherwise, uses the 
+	 * complete sequence.
+	 */
+	if (matchptr[1].rm_so != matchptr[1].rm_eo) {
+		sequence += matchptr[1].rm_so;
+		length = matchptr[1].rm_eo - matchptr[1].rm_so;
+	} else {
+		sequence += matchptr[0].rm_so;
+		length = matchptr[0].rm_eo - matchptr[0].rm_so;
+	}
+
+	/* Do not add the sequence if it contains any illegal characters. */
+	if (!legal_chars(sequence, length)) return 0;
+	
+	char saved = sequence[length];
+	sequence[length] = '\0';
+	int ret = hash_inc(hash, sequence, value);
+	sequence[length] = saved;
+	return ret;
+}
+
+bool legal_chars(const char *sequence, size_t length)
+{
+	size_t i;
+	char c;
+	for (i = 0; i < length; ++i) {
+		c = sequence[i];
+		if (!isprint(c) && c != '\n' && c != '\t')
+			return false;
+	}
+	
+	return true;
+}
+
+/* 
+ * This may be inefficient on 32-bit machines, but if length is declared as size_t then 
+ * this function cannot be guaranteed to work for ASCII files larger than 4 GB.
+ */
+int read_file(char **buffer, uint64_t *length, const char *filename, bool case_sensitive)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) return -1;
+	
+	/* Make room for the whole file, its NUL and one byte more, so that the 
+	 * first fread() comes up short and sees the end of the file. A file whose 
+	 * size is not known starts smaller and doubles.
+	 */
+	struct stat st;
+	uint64_t i = 0, j, capacity = 1 << 16;
+	char *grown;
+	if (fstat(fileno(fp), &st) == 0 && st.st_size > 0)
+		capacity = st.st_size + 2;
+	
+	*buffer = malloc(capacity);
+	while (*buffer && !feof(fp) && !ferror(fp)) {
+		if (i + 1 == capacity) {
+			capacity *= 2;
+			grown = realloc(*buffer, capacity);
+			if (grown == NULL) break;
+			*buffer = grown;
+		}
+		i += fread(*buffer + i, 1, capacity - 1 - i, fp);
+	}
+	
+	if (*buffer == NULL || !feof(fp)) {
+		free(*buffer);
+		*buffer = NULL;
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	
+	if (!case_sensitive)
+		for (j = 0; j < i; ++j)
+			(*buffer)[j] = tolower((*buffer)[j]);
+	
+	(*buffer)[i] = '\0';
+	*length = i;
+	return 0;
+}